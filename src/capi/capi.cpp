@@ -21,7 +21,7 @@ extern "C" {
 	}
 
 	const char* getBalance(const char* address) {
-		Account account = wallet.node.blockChain.getAccountTree().get(fromHex<EccPublicKey>(address));
+		Account account = wallet.node.blockChain.getAccount(fromHex<EccPublicKey>(address));
 		static thread_local std::string str = "";
 		str = amountToCoin(account.balance);
 		return str.c_str();
@@ -101,8 +101,10 @@ extern "C" {
 		for (int i = 0; i < count; i++) {
 			Hash hash = wallet.node.blockChain.getBlockHash(i);
 			Block block = wallet.node.blockChain.getBlock(hash);
-			for (auto& txHash : block.transactionTree.transactionHashes) {
-				Transaction tx = wallet.node.blockChain.getTransaction(txHash);
+			std::vector<Transaction> transactions = wallet.node.blockChain.getTransactions(block.transactionTree.transactionHashes);
+			for (int j = 0; j < (int)transactions.size(); j++) {
+				Transaction& tx = transactions[j];
+				const Hash& txHash = block.transactionTree.transactionHashes[j];
 
 				bool isSender = tx.header.sender == address;
 				bool isRecipient = tx.header.recipient == address;
@@ -165,7 +167,7 @@ extern "C" {
 			type = TransactionType::UNSTAKE;
 		}
 
-		uint32_t transactionNumber = wallet.node.blockChain.getAccountTree().get(sender).transactionCount;
+		uint32_t transactionNumber = wallet.node.blockChain.getAccount(sender).transactionCount;
 
 		for (auto& hash : wallet.node.blockChain.getPendingTransactions()) {
 			Transaction tx = wallet.node.blockChain.getTransaction(hash);
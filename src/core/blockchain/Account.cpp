@@ -29,3 +29,17 @@ int Account::deserial(const std::string& str) {
     serial.read(code);
     return serial.getReadIndex();
 }
+
+bool Account::empty() const {
+    return transactionCount == 0 && balance == 0 && stakeAmount == 0 && stakeOwner == EccPublicKey(0) &&
+        validatorNumber == 0 && stakeBlockNumber == 0 && data == Hash(0) && code == Hash(0);
+}
+
+void setAccount(AccountTree& tree, const EccPublicKey& address, const Account& account, bool removeEmpty) {
+    if (removeEmpty && account.empty()) {
+        tree.remove(address);
+    }
+    else {
+        tree.set(address, account);
+    }
+}
@@ -5,7 +5,7 @@
 #pragma once
 
 #include "Transaction.h"
-#include "BinaryTree.h"
+#include "MerkleTrie.h"
 #include <string>
 
 class Account {
@@ -21,6 +21,14 @@ public:
 
 	std::string serial() const;
 	int deserial(const std::string& str);
+	//the account has no state, like an account that was never used
+	bool empty() const;
 };
 
-typedef BinaryTree<EccPublicKey, Account, true> AccountTree;
+//accounts are keyed by the compressed public key itself, the x coordinate is already uniformly distributed
+//and the constant bits of the prefix byte end up in one shared extension, so hashing the keys wouldn't make the tree shallower
+//a radix 16 trie is faster and smaller, but it changes the account roots, so it needs a block version that migrates the accounts
+typedef MerkleTrie<EccPublicKey, Account, true, 1> AccountTree;
+
+//sets the account, if removeEmpty is set an empty account is removed from the tree instead
+void setAccount(AccountTree& tree, const EccPublicKey& address, const Account& account, bool removeEmpty);
@@ -5,7 +5,15 @@
 #pragma once
 
 #include "storage/KeyValueStorage.h"
+#include "util/ThreadPool.h"
+#include "util/log.h"
 #include "BinaryTreeNode.h"
+#include "BinaryTreeIterator.h"
+#include "BinaryTreeDiff.h"
+#include "BinaryTreeBuilder.h"
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
 
 template<typename KeyType, typename ValueType, bool useSerial>
 class BinaryTree {
@@ -13,6 +21,10 @@ public:
 	typedef BinaryTreeNode<KeyType, ValueType, useSerial> Node;
 	typedef BinaryTree<KeyType, ValueType, useSerial> Tree;
 	typedef BinaryTreeNodeType Type;
+	typedef BinaryTreeKey<KeyType> Key;
+	typedef BinaryTreeIterator<KeyType, ValueType, useSerial> Iterator;
+	typedef BinaryTreeDiff<KeyType, ValueType, useSerial> Diff;
+	typedef BinaryTreeBuilder<KeyType, ValueType, useSerial> Builder;
 
 	void init(KeyValueStorage* storage, const Hash &root = Hash()) {
 		this->storage = storage;
@@ -21,7 +33,12 @@ public:
 
 	Hash getRoot() {
 		if (rootHash == Hash(0)) {
-			rootHash = rootNode->calculateHash();
+			KeyValueStorage::WriteBatch batch;
+			if (hashPool) {
+				calculateHashParallel(batch);
+			}
+			rootHash = rootNode->calculateHash(storage, batch);
+			storage->write(batch);
 			if(rootHash == Hash(-1)){
 				rootHash = Hash(0);
 				return Hash(-1);
@@ -31,17 +48,89 @@ public:
 	}
 
 	void set(const KeyType &key, const ValueType &value) {
-		std::shared_ptr<Node> newRoot;
-		Node* node = rootNode->insert(key, 0, newRoot);
-		if (node && node->type == Type::LEAF) {
-			node->value = value;
-			rootNode = newRoot;
-			rootHash = Hash(0);
+		if (!checkpoints.empty()) {
+			record(key, true);
+		}
+		write(key, value);
+	}
+
+	//returns false if the key is not in the tree
+	bool remove(const KeyType& key) {
+		if (!checkpoints.empty() && !record(key, false)) {
+			return false;
+		}
+		return erase(key);
+	}
+
+	//changes after a checkpoint record the old values of their keys, so they can be reverted without copying the tree
+	//every checkpoint has to be ended with revert or release, checkpoints can be nested
+	int checkpoint() {
+		checkpoints.push_back(journal.size());
+		return journal.size();
+	}
+
+	//sets the keys that changed since the checkpoint back to their old values, the root is the same as at the checkpoint
+	void revert(int checkpoint) {
+		while ((int)journal.size() > checkpoint) {
+			Change& change = journal.back();
+			if (change.existed) {
+				write(change.key, change.value);
+			}
+			else {
+				erase(change.key);
+			}
+			journal.pop_back();
 		}
+		release(checkpoint);
+	}
+
+	//keeps the changes since the checkpoint, they are still reverted by an outer checkpoint
+	//only the innermost checkpoint can be ended
+	void release(int checkpoint) {
+		//ending an outer checkpoint first would keep changes that an inner revert expects to undo
+		if (checkpoints.empty() || checkpoints.back() != checkpoint || checkpoint > (int)journal.size()) {
+			log(LogLevel::FATAL, "Tree", "checkpoint %i is not the innermost open checkpoint", checkpoint);
+			abort();
+		}
+		checkpoints.pop_back();
+		if (checkpoints.empty()) {
+			journal.clear();
+		}
+	}
+
+	//in a batch, nodes that are only owned by this tree are changed in place instead of being copied for every set
+	//nodes that are shared with other instances or copies of the tree are still copied, so they don't see the changes
+	void beginBatch() {
+		batching = true;
+	}
+
+	void setMany(const std::vector<std::pair<KeyType, ValueType>>& values) {
+		for (auto& i : values) {
+			set(i.first, i.second);
+		}
+	}
+
+	//hashes the changed nodes once and writes them in one batch
+	Hash commit() {
+		batching = false;
+		return getRoot();
+	}
+
+	//replaces the content of the tree, the values are sorted into tree order and the nodes are built bottom up
+	//instead of inserting and copying the path for every key, for a key that is given more than once the last value is used
+	void build(std::vector<std::pair<KeyType, ValueType>> values) {
+		std::stable_sort(values.begin(), values.end(), [](const auto& a, const auto& b) {
+			return Iterator::compare(a.first, b.first) < 0;
+		});
+		Builder builder(storage);
+		for (auto& i : values) {
+			builder.add(i.first, i.second);
+		}
+		reset(builder.finish());
 	}
 
 	bool has(const KeyType &key) {
-		Node* node = rootNode->getLeaf(key);
+		Node* node = rootNode->getLeaf(storage, key);
 		if (node && node->type == Type::LEAF) {
 			return true;
 		}
@@ -49,20 +138,20 @@ public:
 	}
 
 	ValueType get(const KeyType &key) {
-		Node *node = rootNode->getLeaf(key);
+		Node *node = rootNode->getLeaf(storage, key);
 		if (node && node->type == Type::LEAF) {
-			return node->value;
+			return node->leaf()->value;
 		}
 		return ValueType();
 	}
 
 	bool reset(const Hash& root = Hash()) {
-		rootNode = std::make_shared<Node>();
-		rootNode->storage = storage;
+		rootNode = Node::create(Type::NONE);
 		rootHash = Hash();
 		if (root != Hash()) {
-			if (storage->has(root)) {
-				rootNode->load(root);
+			std::shared_ptr<Node> node = Node::load(storage, root);
+			if (node->type != Type::NONE) {
+				rootNode = node;
 				rootHash = root;
 				return true;
 			}
@@ -70,21 +159,311 @@ public:
 		return false;
 	}
 
+	Iterator begin() {
+		Iterator iterator(storage, rootNode);
+		iterator.seekFirst();
+		return iterator;
+	}
+
+	//the iterator is on the first key that is equal to or after key in tree order
+	Iterator seek(const KeyType& key) {
+		Iterator iterator(storage, rootNode);
+		iterator.seek(key);
+		return iterator;
+	}
+
+	//calls the callback for the keys from first to before last in tree order, until the callback returns false
+	//returns false if nodes were missing and not all keys could be visited
+	bool scan(const KeyType& first, const KeyType& last, const std::function<bool(const KeyType&, const ValueType&)>& callback) {
+		Iterator iterator = seek(first);
+		for (; iterator.valid() && Iterator::compare(iterator.key(), last) < 0; iterator.next()) {
+			if (!callback(iterator.key(), iterator.value())) {
+				return true;
+			}
+		}
+		return !iterator.failed();
+	}
+
+	//calls the callback for the keys that start with the first prefixBits bits of prefix, until the callback returns false
+	bool scan(const KeyType& prefix, int prefixBits, const std::function<bool(const KeyType&, const ValueType&)>& callback) {
+		//with the other bits set to zero the prefix is the first key that starts with it
+		Key first;
+		first.copyBits(Key(prefix), 0, prefixBits);
+		Iterator iterator = seek(first.key);
+		for (; iterator.valid() && first.bitMatch(Key(iterator.key()), 0) >= prefixBits; iterator.next()) {
+			if (!callback(iterator.key(), iterator.value())) {
+				return true;
+			}
+		}
+		return !iterator.failed();
+	}
+
+	//calls the callback for every key that has a different value in the tree of rootB than in the tree of rootA, in tree order
+	//both trees have to be in the storage of this tree, returns false if nodes were missing
+	bool diff(const Hash& rootA, const Hash& rootB, const typename Diff::Callback& callback) {
+		Diff diff(storage, callback);
+		return diff.run(rootA, rootB);
+	}
+
+	//changed subtrees hashDepth levels below the root are hashed in parallel on the pool, the root is the same as when hashing on one thread
+	void setHashPool(ThreadPool* pool, int hashDepth = 6) {
+		this->hashPool = pool;
+		this->hashDepth = hashDepth;
+	}
+
+	//the proof holds the nodes on the path to the key, it shows the value of the key or that the key is not in the tree
+	//parts that follow from the key and the hashes of the nodes on the path are left out
+	//returns an empty string if the tree can't be hashed or nodes are missing
+	std::string getProof(const KeyType& key) {
+		if (getRoot() == Hash(-1)) {
+			return "";
+		}
+		Key path(key);
+		std::vector<Node*> nodes;
+		std::vector<int> offsets;
+		bool included = false;
+		Node* node = rootNode.get();
+		int bitOffset = 0;
+		while (node->type != Type::NONE) {
+			nodes.push_back(node);
+			offsets.push_back(bitOffset);
+			Node* next = node->getChild(storage, path, bitOffset);
+			if (next == node) {
+				included = true;
+				break;
+			}
+			if (!next) {
+				if (node->type == Type::BRANCH) {
+					return "";
+				}
+				break;
+			}
+			node = next;
+		}
+		if (node->type == Type::NONE && !nodes.empty()) {
+			return "";
+		}
+
+		Serializer serial;
+		serial.write(included);
+		serial.write((uint16_t)nodes.size());
+		for (int i = 0; i < (int)nodes.size(); i++) {
+			Node* node = nodes[i];
+			bool last = i == (int)nodes.size() - 1;
+			serial.write(node->type);
+			serial.write(node->pathLength);
+			if (node->type == Type::BRANCH) {
+				serial.write(node->branch()->childs[!path.getBit(offsets[i])]);
+			}
+			else if (last && node->type == Type::EXTENSION) {
+				serial.writeBytes((uint8_t*)&node->extension()->path.key, (node->pathLength + 7) / 8);
+				serial.write(node->extension()->child);
+			}
+			else if (last && node->type == Type::LEAF) {
+				if (!included) {
+					serial.writeBytes((uint8_t*)&node->leaf()->path.key, (node->pathLength + 7) / 8);
+				}
+				if constexpr (useSerial) {
+					std::string str = node->leaf()->value.serial();
+					serial.writeBytes((uint8_t*)str.data(), str.size());
+				}
+				else {
+					serial.write(node->leaf()->value);
+				}
+			}
+		}
+		return serial.toString();
+	}
+
+	//value is set to the value of the key or to ValueType() if the proof shows that the key is not in the tree
+	static bool verifyProof(const Hash& root, const KeyType& key, const std::string& proof, ValueType& value) {
+		static const int keyBits = sizeof(KeyType) * 8;
+		value = ValueType();
+		Key path(key);
+		Serializer serial(proof);
+		uint8_t included = serial.read<uint8_t>();
+		uint16_t count = serial.read<uint16_t>();
+		if (included > 1 || count > keyBits + 1) {
+			return false;
+		}
+		if (count == 0) {
+			return !included && root == Hash(0) && !serial.hasDataLeft();
+		}
+
+		//the nodes are read from the root down, but can only be hashed from the leaf up
+		std::vector<std::shared_ptr<Node>> nodes;
+		std::vector<int> offsets;
+		int bitOffset = 0;
+		for (int i = 0; i < count; i++) {
+			bool last = i == count - 1;
+			Type type = (Type)serial.read<uint8_t>();
+			uint16_t pathLength = serial.read<uint16_t>();
+			std::shared_ptr<Node> node = Node::create(type);
+			if (type == Type::NONE || node->type != type) {
+				return false;
+			}
+			node->pathLength = pathLength;
+			offsets.push_back(bitOffset);
+
+			if (type == Type::BRANCH) {
+				if (last || pathLength != 0 || bitOffset >= keyBits) {
+					return false;
+				}
+				serial.read(node->branch()->childs[!path.getBit(bitOffset)]);
+				bitOffset++;
+			}
+			else if (type == Type::EXTENSION) {
+				if (pathLength == 0 || pathLength > keyBits - bitOffset) {
+					return false;
+				}
+				if (!last) {
+					node->extension()->path.copyBits(path, bitOffset, pathLength);
+					bitOffset += pathLength;
+				}
+				else {
+					//a proof can only end on an extension if the key leaves it
+					serial.readBytes((uint8_t*)&node->extension()->path.key, (pathLength + 7) / 8);
+					serial.read(node->extension()->child);
+					if (included || node->extension()->path.bitMatch(path, bitOffset) >= pathLength) {
+						return false;
+					}
+				}
+			}
+			else if (type == Type::LEAF) {
+				if (!last || pathLength != keyBits - bitOffset) {
+					return false;
+				}
+				if (included) {
+					node->leaf()->path.copyBits(path, bitOffset, pathLength);
+				}
+				else {
+					serial.readBytes((uint8_t*)&node->leaf()->path.key, (pathLength + 7) / 8);
+					if (node->leaf()->path.bitMatch(path, bitOffset) >= pathLength) {
+						return false;
+					}
+				}
+				if constexpr (useSerial) {
+					//values that don't serialize back to the same bytes are rejected, so every proof has only one encoding
+					std::string str = serial.readAll();
+					node->leaf()->value.deserial(str);
+					if (node->leaf()->value.serial() != str) {
+						return false;
+					}
+				}
+				else {
+					serial.read(node->leaf()->value);
+				}
+			}
+			nodes.push_back(node);
+		}
+		if (serial.hasDataLeft()) {
+			return false;
+		}
+
+		Hash hash = sha256(nodes.back()->serial());
+		for (int i = count - 2; i >= 0; i--) {
+			if (nodes[i]->type == Type::BRANCH) {
+				nodes[i]->branch()->childs[path.getBit(offsets[i])] = hash;
+			}
+			else {
+				nodes[i]->extension()->child = hash;
+			}
+			hash = sha256(nodes[i]->serial());
+		}
+		if (hash != root) {
+			return false;
+		}
+		if (included) {
+			value = nodes.back()->leaf()->value;
+		}
+		return true;
+	}
+
 	Tree createInstance(const Hash& root) {
 		Tree instance;
 		instance.storage = storage;
-		if (root == rootHash) {
-			instance.rootHash = rootHash;
-			instance.rootNode = rootNode;
-		}
-		else {
-			instance.reset(root);
-		}
+		instance.hashPool = hashPool;
+		instance.hashDepth = hashDepth;
+		//nodes are not shared with this tree, the decoded nodes come from the node cache instead
+		//so loaded subtrees are freed with the instance and trees on other threads don't load into the same nodes
+		instance.reset(root);
 		return instance;
 	}
 
 private:
+	class Change {
+	public:
+		KeyType key;
+		bool existed;
+		ValueType value;
+	};
+
 	KeyValueStorage* storage;
 	std::shared_ptr<Node> rootNode;
 	Hash rootHash;
+	bool batching = false;
+	ThreadPool* hashPool = nullptr;
+	int hashDepth = 0;
+	std::vector<Change> journal;
+	//the journal size at every open checkpoint, the innermost is last
+	std::vector<int> checkpoints;
+
+	void write(const KeyType& key, const ValueType& value) {
+		if (batching) {
+			Node* node = Node::insertInPlace(storage, key, 0, rootNode);
+			if (node && node->type == Type::LEAF) {
+				node->leaf()->value = value;
+				rootHash = Hash(0);
+			}
+			return;
+		}
+		std::shared_ptr<Node> newRoot;
+		Node* node = rootNode->insert(storage, key, 0, newRoot);
+		if (node && node->type == Type::LEAF) {
+			node->leaf()->value = value;
+			rootNode = newRoot;
+			rootHash = Hash(0);
+		}
+	}
+
+	bool erase(const KeyType& key) {
+		if (rootNode->type == Type::NONE) {
+			return false;
+		}
+		std::shared_ptr<Node> newRoot;
+		if (!Node::remove(storage, key, 0, rootNode.get(), newRoot)) {
+			return false;
+		}
+		rootNode = newRoot ? newRoot : Node::create(Type::NONE);
+		rootHash = Hash(0);
+		return true;
+	}
+
+	//returns false if the key is not in the tree, a missing key is only recorded if it is going to be set
+	bool record(const KeyType& key, bool recordMissing) {
+		Node* node = rootNode->getLeaf(storage, key);
+		bool existed = node && node->type == Type::LEAF;
+		if (existed || recordMissing) {
+			journal.push_back({ key, existed, existed ? node->leaf()->value : ValueType() });
+		}
+		return existed;
+	}
+
+	void calculateHashParallel(KeyValueStorage::WriteBatch& batch) {
+		std::vector<std::pair<Hash*, Node*>> childs;
+		rootNode->getDirtyChilds(hashDepth, childs);
+		std::vector<KeyValueStorage::WriteBatch> batches(childs.size());
+		std::vector<std::function<void()>> tasks;
+		for (int i = 0; i < (int)childs.size(); i++) {
+			tasks.push_back([&, i]() {
+				Hash hash = childs[i].second->calculateHash(storage, batches[i]);
+				//subtrees that can't be hashed are left changed, so the root fails like it would on one thread
+				*childs[i].first = hash == Hash(-1) ? Hash(0) : hash;
+			});
+		}
+		hashPool->run(tasks);
+		for (auto& i : batches) {
+			batch.append(i);
+		}
+	}
 };
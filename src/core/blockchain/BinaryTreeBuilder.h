@@ -0,0 +1,126 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include "BinaryTreeNode.h"
+
+//builds a tree from keys in tree order in a single pass, the nodes are created and hashed bottom up and written in batches
+//the root is the same as when the keys are set one by one, but no node is copied or hashed twice
+//a subtree is finished as soon as a key arrives that leaves it, so only the nodes on the path of the last key are kept
+template<typename KeyType, typename ValueType, bool useSerial>
+class BinaryTreeBuilder {
+public:
+	typedef BinaryTreeNode<KeyType, ValueType, useSerial> Node;
+	typedef BinaryTreeKey<KeyType> Key;
+	typedef BinaryTreeNodeType Type;
+
+	BinaryTreeBuilder(KeyValueStorage* storage, int batchSize = 4096) {
+		this->storage = storage;
+		this->batchSize = batchSize;
+	}
+
+	//keys have to be added in tree order, a key that is equal to the last one replaces its value
+	//returns false if the key is before the last one
+	bool add(const KeyType& key, const ValueType& value) {
+		Key next(key);
+		if (!items.empty()) {
+			Item& last = items.back();
+			int bit = next.bitMatch(last.key, 0);
+			if (bit >= keyBits) {
+				last.value = value;
+				return true;
+			}
+			if (!next.getBit(bit)) {
+				return false;
+			}
+			//all subtrees that split after this bit are complete
+			while (!bits.empty() && bits.back() > bit) {
+				merge();
+			}
+			bits.push_back(bit);
+		}
+		items.push_back({ keyBits, next, Hash(0), value });
+		return true;
+	}
+
+	//writes the remaining nodes and returns the root, Hash(0) if no keys were added
+	Hash finish() {
+		while (!bits.empty()) {
+			merge();
+		}
+		Hash root = Hash(0);
+		if (!items.empty()) {
+			root = write(items.back(), 0);
+			items.clear();
+		}
+		storage->write(batch);
+		batch.clear();
+		return root;
+	}
+
+private:
+	//a finished subtree, either a single leaf or a branch at bit top
+	//the node above the branch or the leaf itself is only written when it is known where the parent ends
+	class Item {
+	public:
+		int top;
+		//any key of the subtree, the bits before top are the same for all of them
+		Key key;
+		Hash hash;
+		ValueType value;
+	};
+
+	static const int keyBits = sizeof(KeyType) * 8;
+	KeyValueStorage* storage;
+	int batchSize;
+	KeyValueStorage::WriteBatch batch;
+	std::vector<Item> items;
+	//the bits at which neighboring items split
+	std::vector<int> bits;
+
+	//joins the last two items with a branch at the bit where they split
+	void merge() {
+		int bit = bits.back();
+		bits.pop_back();
+		Item right = items.back();
+		items.pop_back();
+		Item& left = items.back();
+
+		std::shared_ptr<Node> node = Node::createBranch();
+		node->branch()->childs[0] = write(left, bit + 1);
+		node->branch()->childs[1] = write(right, bit + 1);
+		left.top = bit;
+		left.hash = write(node.get());
+		left.value = ValueType();
+	}
+
+	//writes the nodes of an item that starts at bitOffset and returns the hash of its first node
+	Hash write(const Item& item, int bitOffset) {
+		if (item.top == keyBits) {
+			std::shared_ptr<Node> leaf = Node::createLeaf(item.key, bitOffset);
+			leaf->leaf()->value = item.value;
+			return write(leaf.get());
+		}
+		if (item.top == bitOffset) {
+			return item.hash;
+		}
+		std::shared_ptr<Node> extension = Node::createExtension(item.key, bitOffset, item.top - bitOffset);
+		extension->extension()->child = item.hash;
+		return write(extension.get());
+	}
+
+	Hash write(Node* node) {
+		std::string data = node->serial();
+		Hash hash = sha256(data);
+		if (!storage->has(hash)) {
+			batch.set(hash, data);
+			if (batch.size() >= batchSize) {
+				storage->write(batch);
+				batch.clear();
+			}
+		}
+		return hash;
+	}
+};
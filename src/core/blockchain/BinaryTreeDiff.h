@@ -0,0 +1,216 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include "BinaryTreeNode.h"
+#include <functional>
+
+//walks two trees side by side and reports the keys whose values differ, in tree order
+//subtrees with the same hash are skipped, so the cost depends on the size of the change and not the size of the trees
+//the trees can split their keys at different nodes, so both sides are compared at the same bit offset
+template<typename KeyType, typename ValueType, bool useSerial>
+class BinaryTreeDiff {
+public:
+	typedef BinaryTreeNode<KeyType, ValueType, useSerial> Node;
+	typedef BinaryTreeKey<KeyType> Key;
+	typedef BinaryTreeNodeType Type;
+	//the old value is null for added keys, the new value is null for removed keys
+	typedef std::function<void(const KeyType& key, const ValueType* oldValue, const ValueType* newValue)> Callback;
+
+	BinaryTreeDiff(KeyValueStorage* storage, const Callback& callback) {
+		this->storage = storage;
+		this->callback = callback;
+	}
+
+	//returns false if nodes were missing, the keys below them are not reported
+	bool run(const Hash& rootA, const Hash& rootB) {
+		error = false;
+		diff(load(rootA), load(rootB), 0);
+		return !error;
+	}
+
+private:
+	//a node and the number of bits of its path that are already before the current bit offset
+	class Cursor {
+	public:
+		std::shared_ptr<Node> node;
+		//only set for whole nodes
+		Hash hash;
+		int skip = 0;
+	};
+
+	KeyValueStorage* storage;
+	Callback callback;
+	Key path;
+	bool error = false;
+
+	void diff(Cursor a, Cursor b, int bitOffset) {
+		if (error || (!a.node && !b.node)) {
+			return;
+		}
+		if (!a.node) {
+			visit(b, bitOffset, false);
+			return;
+		}
+		if (!b.node) {
+			visit(a, bitOffset, true);
+			return;
+		}
+		if (a.skip == 0 && b.skip == 0 && a.hash == b.hash) {
+			return;
+		}
+
+		if (a.node->type != Type::BRANCH && b.node->type != Type::BRANCH) {
+			const Key& pathA = getPath(a.node.get());
+			const Key& pathB = getPath(b.node.get());
+			int count = std::min(a.node->pathLength - a.skip, b.node->pathLength - b.skip);
+			int match = bitMatch(pathA, a.skip, pathB, b.skip, count);
+			setPath(bitOffset, pathA, a.skip, match);
+			a.skip += match;
+			b.skip += match;
+			bitOffset += match;
+			if (match < count) {
+				//the paths split, so the keys of the two sides are disjoint, the side with the zero bit comes first
+				a.hash = Hash(0);
+				b.hash = Hash(0);
+				if (!pathA.getBit(a.skip)) {
+					visit(a, bitOffset, true);
+					visit(b, bitOffset, false);
+				}
+				else {
+					visit(b, bitOffset, false);
+					visit(a, bitOffset, true);
+				}
+			}
+			else if (a.node->type == Type::LEAF && b.node->type == Type::LEAF) {
+				//leaves end at the end of the key, so both of them are at the end here
+				if (!equal(a.node->leaf()->value, b.node->leaf()->value)) {
+					callback(path.key, &a.node->leaf()->value, &b.node->leaf()->value);
+				}
+			}
+			else {
+				diff(next(a), next(b), bitOffset);
+			}
+			return;
+		}
+
+		if (a.node->type == Type::BRANCH && b.node->type == Type::BRANCH) {
+			//equal children are not loaded at all
+			for (int i = 0; i < 2; i++) {
+				if (a.node->branch()->childs[i] != b.node->branch()->childs[i]) {
+					path.setBit(bitOffset, i);
+					diff(load(a.node->branch()->childs[i]), load(b.node->branch()->childs[i]), bitOffset + 1);
+				}
+			}
+			return;
+		}
+
+		//one side splits here, the other side is split at the next bit of its path
+		Cursor childsA[2];
+		Cursor childsB[2];
+		split(a, childsA);
+		split(b, childsB);
+		for (int i = 0; i < 2; i++) {
+			path.setBit(bitOffset, i);
+			diff(childsA[i], childsB[i], bitOffset + 1);
+		}
+	}
+
+	//reports all keys below the cursor as removed or added
+	void visit(const Cursor& cursor, int bitOffset, bool removed) {
+		if (error) {
+			return;
+		}
+		Node* node = cursor.node.get();
+		if (node->type == Type::BRANCH) {
+			Cursor childs[2];
+			split(cursor, childs);
+			for (int i = 0; i < 2; i++) {
+				path.setBit(bitOffset, i);
+				visit(childs[i], bitOffset + 1, removed);
+			}
+			return;
+		}
+		int length = node->pathLength - cursor.skip;
+		setPath(bitOffset, getPath(node), cursor.skip, length);
+		if (node->type == Type::LEAF) {
+			const ValueType* value = &node->leaf()->value;
+			callback(path.key, removed ? value : nullptr, removed ? nullptr : value);
+		}
+		else {
+			Cursor child = next({ cursor.node, Hash(0), node->pathLength });
+			if (!error) {
+				visit(child, bitOffset + length, removed);
+			}
+		}
+	}
+
+	void split(const Cursor& cursor, Cursor* childs) {
+		Node* node = cursor.node.get();
+		if (node->type == Type::BRANCH) {
+			childs[0] = load(node->branch()->childs[0]);
+			childs[1] = load(node->branch()->childs[1]);
+		}
+		else {
+			bool bit = getPath(node).getBit(cursor.skip);
+			childs[bit] = next({ cursor.node, Hash(0), cursor.skip + 1 });
+		}
+	}
+
+	//moves past an extension that was completely passed
+	Cursor next(const Cursor& cursor) {
+		if (cursor.node->type == Type::EXTENSION && cursor.skip >= cursor.node->pathLength) {
+			return load(cursor.node->extension()->child);
+		}
+		return cursor;
+	}
+
+	Cursor load(const Hash& hash) {
+		Cursor cursor;
+		if (hash == Hash(0)) {
+			return cursor;
+		}
+		std::shared_ptr<Node> node = Node::load(storage, hash);
+		if (node->type == Type::NONE) {
+			error = true;
+			return cursor;
+		}
+		cursor.node = node;
+		cursor.hash = hash;
+		return cursor;
+	}
+
+	static const Key& getPath(Node* node) {
+		return node->type == Type::LEAF ? node->leaf()->path : node->extension()->path;
+	}
+
+	static bool equal(const ValueType& a, const ValueType& b) {
+		if constexpr (useSerial) {
+			return a.serial() == b.serial();
+		}
+		else {
+			return a == b;
+		}
+	}
+
+	//number of equal bits of a and b starting at their offsets, up to count
+	static int bitMatch(const Key& a, int offsetA, const Key& b, int offsetB, int count) {
+		for (int i = 0; i < count; i += 64) {
+			int bits = std::min(64, count - i);
+			uint64_t difference = a.getBits(offsetA + i, bits) ^ b.getBits(offsetB + i, bits);
+			if (difference != 0) {
+				return i + std::countr_zero(difference);
+			}
+		}
+		return count;
+	}
+
+	void setPath(int bitOffset, const Key& value, int valueOffset, int bitCount) {
+		for (int i = 0; i < bitCount; i += 64) {
+			int count = std::min(64, bitCount - i);
+			path.setBits(bitOffset + i, value.getBits(valueOffset + i, count), count);
+		}
+	}
+};
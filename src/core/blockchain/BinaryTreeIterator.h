@@ -0,0 +1,252 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include "BinaryTreeNode.h"
+
+//walks the leaves of a tree in tree order, keys are compared bit by bit starting with bit 0 of the first byte
+//nodes that the tree didn't load yet are loaded by the iterator and freed again when the cursor leaves their subtree,
+//so a scan doesn't grow the tree and only holds the nodes around the cursor
+//the iterator keeps the nodes it is on alive, later changes to the tree are not seen by it
+template<typename KeyType, typename ValueType, bool useSerial>
+class BinaryTreeIterator {
+public:
+	typedef BinaryTreeNode<KeyType, ValueType, useSerial> Node;
+	typedef BinaryTreeKey<KeyType> Key;
+	typedef BinaryTreeNodeType Type;
+
+	//prefetchCount is the largest number of nodes that are read at once when the cursor reaches nodes that are not loaded
+	//the iterator is not on a key until seekFirst or seek is called
+	BinaryTreeIterator(KeyValueStorage* storage, const std::shared_ptr<Node>& root, int prefetchCount = 4096) {
+		this->storage = storage;
+		this->root = root;
+		this->prefetchCount = prefetchCount;
+	}
+
+	bool valid() const {
+		return leaf != nullptr;
+	}
+
+	//a node could not be loaded, the iteration ended early
+	bool failed() const {
+		return error;
+	}
+
+	const KeyType& key() const {
+		return path.key;
+	}
+
+	const ValueType& value() const {
+		return leaf->leaf()->value;
+	}
+
+	void next() {
+		leaf = nullptr;
+		advance();
+	}
+
+	void seekFirst() {
+		start();
+		advance();
+	}
+
+	//moves to the first key that is equal to or after key
+	void seek(const KeyType& key) {
+		Key target(key);
+		start();
+		while (!stack.empty() && !leaf && !error) {
+			Frame& frame = stack.back();
+			Node* node = frame.node.get();
+			if (node->type == Type::BRANCH) {
+				frame.child = target.getBit(frame.bitOffset);
+				step();
+			}
+			else if (node->type == Type::EXTENSION || node->type == Type::LEAF) {
+				const Key& nodePath = node->type == Type::LEAF ? node->leaf()->path : node->extension()->path;
+				int match = nodePath.bitMatch(target, frame.bitOffset);
+				if (match >= node->pathLength) {
+					step();
+				}
+				else {
+					//the subtree is either completely after the key or completely before it
+					if (!nodePath.getBit(match)) {
+						frame.child = 1;
+					}
+					break;
+				}
+			}
+			else {
+				break;
+			}
+		}
+		advance();
+	}
+
+	//returns -1, 0 or 1 if a is before, equal to or after b in tree order
+	static int compare(const KeyType& a, const KeyType& b) {
+		Key key(a);
+		int match = key.bitMatch(Key(b), 0);
+		if (match >= (int)sizeof(KeyType) * 8) {
+			return 0;
+		}
+		return key.getBit(match) ? 1 : -1;
+	}
+
+private:
+	class Frame {
+	public:
+		std::shared_ptr<Node> node;
+		int bitOffset;
+		//the next child to visit, leaves and extensions only have one
+		int child;
+		//the node was loaded by the iterator and is not part of the tree, so children can be attached to it
+		bool owned;
+	};
+
+	KeyValueStorage* storage;
+	std::shared_ptr<Node> root;
+	int prefetchCount;
+	int window = 16;
+	std::vector<Frame> stack;
+	Key path;
+	Node* leaf = nullptr;
+	bool error = false;
+
+	void start() {
+		window = 16;
+		stack.clear();
+		leaf = nullptr;
+		error = false;
+		if (root->type != Type::NONE) {
+			stack.push_back({ root, 0, 0, false });
+		}
+	}
+
+	void advance() {
+		while (!stack.empty() && !leaf) {
+			if (!step()) {
+				stack.pop_back();
+			}
+		}
+	}
+
+	//visits the next child of the node on top of the stack, returns false if there is none left
+	bool step() {
+		Frame& frame = stack.back();
+		Node* node = frame.node.get();
+		int bitOffset = frame.bitOffset;
+		if (node->type == Type::LEAF && frame.child == 0) {
+			frame.child = 1;
+			setPath(bitOffset, node->leaf()->path, node->pathLength);
+			leaf = node;
+			return true;
+		}
+		else if (node->type == Type::EXTENSION && frame.child == 0) {
+			frame.child = 1;
+			setPath(bitOffset, node->extension()->path, node->pathLength);
+			push(frame, 0, bitOffset + node->pathLength);
+			return true;
+		}
+		else if (node->type == Type::BRANCH && frame.child < 2) {
+			int index = frame.child++;
+			if (index == 1 && frame.owned) {
+				node->branch()->nodes[0].reset();
+			}
+			path.setBit(bitOffset, index);
+			push(frame, index, bitOffset + 1);
+			return true;
+		}
+		return false;
+	}
+
+	void push(Frame& parent, int index, int bitOffset) {
+		Node* node = parent.node.get();
+		std::shared_ptr<Node>& child = node->type == Type::BRANCH ? node->branch()->nodes[index] : node->extension()->node;
+		const Hash& hash = node->type == Type::BRANCH ? node->branch()->childs[index] : node->extension()->child;
+		bool owned = parent.owned;
+		std::shared_ptr<Node> next = child;
+		if (!next && hash != Hash(0)) {
+			next = load(hash);
+			owned = true;
+		}
+		if (!next || next->type == Type::NONE) {
+			error = true;
+			stack.clear();
+			return;
+		}
+		stack.push_back({ next, bitOffset, 0, owned });
+	}
+
+	void setPath(int bitOffset, const Key& value, int bitCount) {
+		for (int i = 0; i < bitCount; i += 64) {
+			int count = std::min(64, bitCount - i);
+			path.setBits(bitOffset + i, value.getBits(i, count), count);
+		}
+	}
+
+	//loads the node and the nodes below it breadth first, a level is read with one call to the storage
+	//so the siblings of the nodes on the way down are already there when the cursor gets to them
+	//like a readahead the number of nodes doubles with every load, so seeks and short scans don't read much more than they use
+	std::shared_ptr<Node> load(const Hash& hash) {
+		std::shared_ptr<Node> node = loadMany({ hash })[0];
+		std::vector<Node*> level = { node.get() };
+		int count = 1;
+		int limit = std::min(window, prefetchCount);
+		window = limit * 2;
+		while (!level.empty() && count < limit) {
+			std::vector<Hash> hashes;
+			std::vector<std::shared_ptr<Node>*> childs;
+			for (Node* parent : level) {
+				if (parent->type == Type::BRANCH) {
+					for (int i = 0; i < 2; i++) {
+						hashes.push_back(parent->branch()->childs[i]);
+						childs.push_back(&parent->branch()->nodes[i]);
+					}
+				}
+				else if (parent->type == Type::EXTENSION) {
+					hashes.push_back(parent->extension()->child);
+					childs.push_back(&parent->extension()->node);
+				}
+			}
+			if ((int)hashes.size() > limit - count) {
+				hashes.resize(limit - count);
+			}
+			std::vector<std::shared_ptr<Node>> nodes = loadMany(hashes);
+			level.clear();
+			for (int i = 0; i < (int)nodes.size(); i++) {
+				if (nodes[i]->type != Type::NONE) {
+					*childs[i] = nodes[i];
+					level.push_back(nodes[i].get());
+				}
+			}
+			count += nodes.size();
+		}
+		return node;
+	}
+
+	//nodes that are not cached already are not added to the node cache, so a scan doesn't push out the nodes that are used often
+	std::vector<std::shared_ptr<Node>> loadMany(const std::vector<Hash>& hashes) {
+		std::vector<std::shared_ptr<Node>> nodes(hashes.size());
+		std::vector<Hash> missing;
+		std::vector<int> indices;
+		for (int i = 0; i < (int)hashes.size(); i++) {
+			std::shared_ptr<const Node> cached = Node::getCache().get(hashes[i]);
+			if (cached) {
+				nodes[i] = cached->copy();
+			}
+			else {
+				missing.push_back(hashes[i]);
+				indices.push_back(i);
+			}
+		}
+		if (!missing.empty()) {
+			std::vector<std::string> values = storage->getMany(missing);
+			for (int i = 0; i < (int)values.size(); i++) {
+				nodes[indices[i]] = Node::decode(values[i]);
+			}
+		}
+		return nodes;
+	}
+};
@@ -5,9 +5,16 @@
 #pragma once
 
 #include "type.h"
+#include "storage/KeyValueStorage.h"
 #include "util/Serializer.h"
+#include "util/PoolAllocator.h"
+#include "NodeCache.h"
 #include "cryptography/sha.h"
 #include <memory>
+#include <bit>
+#include <cstring>
+#include <algorithm>
+#include <vector>
 
 enum class BinaryTreeNodeType : uint8_t {
 	NONE,
@@ -26,7 +33,8 @@ public:
 		this->key = key;
 	}
 
-	BinaryTreeKey(){}
+	//the key is zeroed, path bits past the path length are serialized and have to be zero
+	BinaryTreeKey() : key() {}
 
 	bool getBit(int bitIndex) const {
 		int byte = bitIndex / 8;
@@ -48,41 +56,186 @@ public:
 		}
 	}
 
-	int bitMatch(const Key& value, int bitOffset) {
+	//reads up to 64 bits starting at bitIndex, the first bit ends up in the lowest bit
+	uint64_t getBits(int bitIndex, int bitCount) const {
+		const uint8_t* bytes = (const uint8_t*)&key;
+		int byte = bitIndex / 8;
+		int shift = bitIndex % 8;
+
+		//9 bytes cover 64 bits at any shift, at the end of the key the missing bytes are zero
+		uint64_t word = 0;
+		uint64_t next = 0;
+		if (byte + 9 <= (int)sizeof(KeyType)) {
+			memcpy(&word, bytes + byte, sizeof(word));
+			next = bytes[byte + 8];
+		}
+		else if (byte < (int)sizeof(KeyType)) {
+			memcpy(&word, bytes + byte, std::min<int>(sizeof(word), sizeof(KeyType) - byte));
+		}
+		word >>= shift;
+		if (shift > 0) {
+			word |= next << (64 - shift);
+		}
+		if (bitCount < 64) {
+			word &= ((uint64_t)1 << bitCount) - 1;
+		}
+		return word;
+	}
+
+	//writes the lowest bitCount bits of value starting at bitIndex, the other bits are not changed
+	void setBits(int bitIndex, uint64_t value, int bitCount) {
+		uint8_t* bytes = (uint8_t*)&key;
+		while (bitCount > 0) {
+			int byte = bitIndex / 8;
+			int shift = bitIndex % 8;
+			int count = std::min(8 - shift, bitCount);
+			uint8_t mask = (uint8_t)(((1 << count) - 1) << shift);
+			bytes[byte] = (bytes[byte] & ~mask) | ((uint8_t)(value << shift) & mask);
+			value >>= count;
+			bitIndex += count;
+			bitCount -= count;
+		}
+	}
+
+	//copies bitCount bits of value starting at bitOffset to the start of this key, the bits after them are not changed
+	void copyBits(const Key& value, int bitOffset, int bitCount) {
+		uint8_t* bytes = (uint8_t*)&key;
+		for (int i = 0; i < bitCount; i += 64) {
+			int count = std::min(64, bitCount - i);
+			uint64_t word = value.getBits(i + bitOffset, count);
+			int byte = i / 8;
+			memcpy(bytes + byte, &word, count / 8);
+			if (count % 8 != 0) {
+				uint8_t mask = (uint8_t)((1 << (count % 8)) - 1);
+				uint8_t& last = bytes[byte + count / 8];
+				last = (last & ~mask) | ((uint8_t)(word >> (count / 8 * 8)) & mask);
+			}
+		}
+	}
+
+	//returns the number of leading bits of this key that are equal to the bits of value starting at bitOffset
+	int bitMatch(const Key& value, int bitOffset) const {
 		int left = (sizeof(KeyType) * 8) - bitOffset;
-		for (int i = 0; i < left; i++) {
-			if (getBit(i) != value.getBit(i + bitOffset)) {
-				return i;
+		for (int i = 0; i < left; i += 64) {
+			int count = std::min(64, left - i);
+			uint64_t difference = getBits(i, count) ^ value.getBits(i + bitOffset, count);
+			if (difference != 0) {
+				return i + std::countr_zero(difference);
 			}
 		}
 		return left;
 	}
 };
 
+template<typename KeyType, typename ValueType, bool useSerial>
+class BinaryTreeBranch;
+template<typename KeyType, typename ValueType, bool useSerial>
+class BinaryTreeExtension;
+template<typename KeyType, typename ValueType, bool useSerial>
+class BinaryTreeLeaf;
+
+//common part of all nodes, the type decides which of the node classes an object actually is
+//nodes only hold what their type needs and are allocated from a pool, because every insert copies the nodes along the path
+//a node of type NONE is only used as the root of an empty tree
 template<typename KeyType, typename ValueType, bool useSerial>
 class BinaryTreeNode {
 public:
 	typedef BinaryTreeNode<KeyType, ValueType, useSerial> Node;
+	typedef BinaryTreeBranch<KeyType, ValueType, useSerial> Branch;
+	typedef BinaryTreeExtension<KeyType, ValueType, useSerial> Extension;
+	typedef BinaryTreeLeaf<KeyType, ValueType, useSerial> Leaf;
 	typedef BinaryTreeKey<KeyType> Key;
 	typedef BinaryTreeNodeType Type;
 
 	BinaryTreeNodeType type;
 	uint16_t pathLength;
-	
-	Hash childs[2];
-	Key path;
-	ValueType value;
-
-	std::shared_ptr<Node> nodes[2];
-	KeyValueStorage* storage;
 
 	BinaryTreeNode() {
 		type = BinaryTreeNodeType::NONE;
 		pathLength = 0;
-		path = Key();
-		value = ValueType();
-		childs[0] = 0;
-		childs[1] = 0;
+	}
+
+	Branch* branch() {
+		return static_cast<Branch*>(this);
+	}
+
+	Extension* extension() {
+		return static_cast<Extension*>(this);
+	}
+
+	Leaf* leaf() {
+		return static_cast<Leaf*>(this);
+	}
+
+	static std::shared_ptr<Node> create(Type type) {
+		if (type == Type::BRANCH) {
+			return std::allocate_shared<Branch>(PoolAllocator<Branch>());
+		}
+		else if (type == Type::EXTENSION) {
+			return std::allocate_shared<Extension>(PoolAllocator<Extension>());
+		}
+		else if (type == Type::LEAF) {
+			return std::allocate_shared<Leaf>(PoolAllocator<Leaf>());
+		}
+		return std::allocate_shared<Node>(PoolAllocator<Node>());
+	}
+
+	static NodeCache<Node>& getCache() {
+		return NodeCache<Node>::getInstance();
+	}
+
+	//missing or unknown nodes result in an empty node
+	static std::shared_ptr<Node> load(KeyValueStorage* storage, const Hash& hash) {
+		std::shared_ptr<const Node> cached = getCache().get(hash);
+		if (cached) {
+			return cached->copy();
+		}
+		std::shared_ptr<Node> node = decode(storage->get(hash));
+		if (node->type != Type::NONE) {
+			getCache().set(hash, node->copy(), node->getMemorySize());
+		}
+		return node;
+	}
+
+	//empty data or an unknown type results in an empty node
+	static std::shared_ptr<Node> decode(const std::string& data) {
+		if (data.empty()) {
+			return create(Type::NONE);
+		}
+		std::shared_ptr<Node> node = create((Type)data[0]);
+		if (node->type != (Type)data[0]) {
+			return node;
+		}
+		node->deserial(data);
+		return node;
+	}
+
+	std::shared_ptr<Node> copy() const {
+		if (type == Type::BRANCH) {
+			return std::allocate_shared<Branch>(PoolAllocator<Branch>(), static_cast<const Branch&>(*this));
+		}
+		else if (type == Type::EXTENSION) {
+			return std::allocate_shared<Extension>(PoolAllocator<Extension>(), static_cast<const Extension&>(*this));
+		}
+		else if (type == Type::LEAF) {
+			return std::allocate_shared<Leaf>(PoolAllocator<Leaf>(), static_cast<const Leaf&>(*this));
+		}
+		return std::allocate_shared<Node>(PoolAllocator<Node>(), *this);
+	}
+
+	//approximate, including the overhead of the shared pointer
+	uint64_t getMemorySize() const {
+		uint64_t size = sizeof(Node);
+		if (type == Type::BRANCH) {
+			size = sizeof(Branch);
+		}
+		else if (type == Type::EXTENSION) {
+			size = sizeof(Extension);
+		}
+		else if (type == Type::LEAF) {
+			size = sizeof(Leaf);
+		}
+		return size + 64;
 	}
 
 	std::string serial() {
@@ -90,230 +243,185 @@ public:
 		serial.write(type);
 		serial.write(pathLength);
 		if (type == BinaryTreeNodeType::BRANCH) {
-			serial.write(childs[0]);
-			serial.write(childs[1]);
+			serial.write(branch()->childs[0]);
+			serial.write(branch()->childs[1]);
 		}
 		else if (type == BinaryTreeNodeType::EXTENSION) {
-			serial.write(path);
-			serial.write(childs[0]);
+			serial.write(extension()->path);
+			serial.write(extension()->child);
 		}
 		else if (type == BinaryTreeNodeType::LEAF) {
-			serial.write(path);
+			serial.write(leaf()->path);
 			if constexpr (useSerial) {
-				std::string str = value.serial();
+				std::string str = leaf()->value.serial();
 				serial.writeBytes((uint8_t*)str.data(), str.size());
 			}
 			else {
-				serial.write(value);
+				serial.write(leaf()->value);
 			}
 		}
 		return serial.toString();
 	}
 
+	//the node has to be created with the type that is stored in the data
 	int deserial(const std::string& str) {
 		Serializer serial(str);
 		serial.read(type);
 		serial.read(pathLength);
 		if (type == BinaryTreeNodeType::BRANCH) {
-			serial.read(childs[0]);
-			serial.read(childs[1]);
+			serial.read(branch()->childs[0]);
+			serial.read(branch()->childs[1]);
 		}
 		else if (type == BinaryTreeNodeType::EXTENSION) {
-			serial.read(path);
-			serial.read(childs[0]);
+			serial.read(extension()->path);
+			serial.read(extension()->child);
 		}
 		else if (type == BinaryTreeNodeType::LEAF) {
-			serial.read(path);
+			serial.read(leaf()->path);
 			if constexpr (useSerial) {
-				value.deserial(serial.readAll());
+				leaf()->value.deserial(serial.readAll());
 			}
 			else {
-				serial.read(value);
+				serial.read(leaf()->value);
 			}
 		}
 		return serial.getReadIndex();
 	}
 
-	Hash calculateHash() {
+	Hash calculateHash(KeyValueStorage* storage, KeyValueStorage::WriteBatch &batch) {
 		if (type == Type::NONE) {
 			return Hash(0);
 		}
 		else if (type == BinaryTreeNodeType::BRANCH) {
-			if (childs[0] == Hash(0)) {
-				if(nodes[0]){
-					childs[0] = nodes[0]->calculateHash();
-					if(childs[0] == Hash(-1)){
-						childs[0] = Hash(0);
-						return Hash(-1);
-					}
-				}else{
-					return Hash(-1);
-				}
-			}
-			if (childs[1] == Hash(0)) {
-				if(nodes[1]){
-					childs[1] = nodes[1]->calculateHash();
-					if(childs[1] == Hash(-1)){
-						childs[1] = Hash(0);
-						return Hash(-1);
-					}
-				}else{
+			for (int i = 0; i < 2; i++) {
+				if (!calculateChildHash(storage, batch, branch()->childs[i], branch()->nodes[i])) {
 					return Hash(-1);
 				}
 			}
 		}
 		else if (type == BinaryTreeNodeType::EXTENSION) {
-			if (childs[0] == Hash(0)) {
-				if(nodes[0]){
-					childs[0] = nodes[0]->calculateHash();
-					if(childs[0] == Hash(-1)){
-						childs[0] = Hash(0);
-						return Hash(-1);
-					}
-				}else{
-					return Hash(-1);
-				}
+			if (!calculateChildHash(storage, batch, extension()->child, extension()->node)) {
+				return Hash(-1);
 			}
 		}
-		Hash hash = sha256(serial());
+		std::string data = serial();
+		Hash hash = sha256(data);
 		if (!storage->has(hash)) {
-			storage->set(hash, serial());
+			batch.set(hash, data);
 		}
 		return hash;
 	}
 
-	void load(const Hash& hash) {
-		if (storage->has(hash)) {
-			deserial(storage->get(hash));
+	//collects the changed children depth levels below this node, so they can be hashed independently
+	void getDirtyChilds(int depth, std::vector<std::pair<Hash*, Node*>>& childs) {
+		if (type == Type::BRANCH) {
+			for (int i = 0; i < 2; i++) {
+				getDirtyChild(depth, branch()->childs[i], branch()->nodes[i].get(), childs);
+			}
+		}
+		else if (type == Type::EXTENSION) {
+			getDirtyChild(depth, extension()->child, extension()->node.get(), childs);
 		}
 	}
 
-	Node* getChild(const Key& key, int &bitOffset) {
+	Node* getChild(KeyValueStorage* storage, const Key& key, int &bitOffset) {
 		if (type == Type::BRANCH) {
 			bool bit = key.getBit(bitOffset);
-			if (!nodes[bit]) {
-				if (childs[bit] == Hash(0)) {
+			Branch* node = branch();
+			if (!node->nodes[bit]) {
+				if (node->childs[bit] == Hash(0)) {
 					return nullptr;
 				}
-				else {
-					auto node = std::make_shared<Node>();
-					node->storage = storage;
-					node->load(childs[bit]);
-					nodes[bit] = node;
-				}
+				node->nodes[bit] = load(storage, node->childs[bit]);
 			}
 			bitOffset++;
-			return nodes[bit].get();
+			return node->nodes[bit].get();
 		}
-		else {
-			int match = path.bitMatch(key, bitOffset);
-			if (match >= pathLength) {
-				match = pathLength;
-				if (type == Type::LEAF) {
-					bitOffset += match;
-					return this;
-				}
-				else if (type == Type::EXTENSION) {
-					if (!nodes[0]) {
-						if (childs[0] == Hash(0)) {
-							return nullptr;
-						}
-						else {
-							auto node = std::make_shared<Node>();
-							node->storage = storage;
-							node->load(childs[0]);
-							nodes[0] = node;
-						}
+		else if (type == Type::LEAF) {
+			if (leaf()->path.bitMatch(key, bitOffset) >= pathLength) {
+				bitOffset += pathLength;
+				return this;
+			}
+			return nullptr;
+		}
+		else if (type == Type::EXTENSION) {
+			Extension* node = extension();
+			if (node->path.bitMatch(key, bitOffset) >= pathLength) {
+				if (!node->node) {
+					if (node->child == Hash(0)) {
+						return nullptr;
 					}
-					bitOffset += match;
-					return nodes[0].get();
-				}
-				else {
-					return nullptr;
+					node->node = load(storage, node->child);
 				}
+				bitOffset += pathLength;
+				return node->node.get();
 			}
-			else {
-				return nullptr;
-			}
+			return nullptr;
 		}
+		return nullptr;
 	}
 	
-	Node* getLeaf(const Key &key, int bitOffset = 0) {
-		Node* child = getChild(key, bitOffset);
+	Node* getLeaf(KeyValueStorage* storage, const Key &key, int bitOffset = 0) {
+		Node* child = getChild(storage, key, bitOffset);
 		if (child) {
 			if (child == this) {
 				return child;
 			}
-			return child->getLeaf(key, bitOffset);
+			return child->getLeaf(storage, key, bitOffset);
 		}
 		else {
 			return nullptr;
 		}
 	}
 
-	std::shared_ptr<Node> createLeaf(const Key& key, int bitOffset) {
-		std::shared_ptr<Node> node = std::make_shared<Node>();
-		node->storage = storage;
-		node->type = Type::LEAF;
+	static std::shared_ptr<Node> createLeaf(const Key& key, int bitOffset) {
+		std::shared_ptr<Node> node = create(Type::LEAF);
 		node->pathLength = (sizeof(key) * 8) - bitOffset;
-		for (int i = 0; i < node->pathLength; i++) {
-			node->path.setBit(i, key.getBit(i + bitOffset));
-		}
+		node->leaf()->path.copyBits(key, bitOffset, node->pathLength);
 		return node;
 	}
 	
-	std::shared_ptr<Node> createExtension(const Key& key, int bitOffset, int pathLength) {
-		std::shared_ptr<Node> node = std::make_shared<Node>();
-		node->storage = storage;
-		node->type = Type::EXTENSION;
+	static std::shared_ptr<Node> createExtension(const Key& key, int bitOffset, int pathLength) {
+		std::shared_ptr<Node> node = create(Type::EXTENSION);
 		node->pathLength = pathLength;
-		for (int i = 0; i < node->pathLength; i++) {
-			node->path.setBit(i, key.getBit(i + bitOffset));
-		}
+		node->extension()->path.copyBits(key, bitOffset, node->pathLength);
 		return node;
 	}
 
-	std::shared_ptr<Node> createBranch() {
-		std::shared_ptr<Node> node = std::make_shared<Node>();
-		node->storage = storage;
-		node->type = Type::BRANCH;
-		node->pathLength = 0;
-		return node;
+	static std::shared_ptr<Node> createBranch() {
+		return create(Type::BRANCH);
 	}
 
-	Node* insert(const Key& key, int bitOffset, std::shared_ptr<Node> &newRoot) {
-		Node* next = getChild(key, bitOffset);
+	Node* insert(KeyValueStorage* storage, const Key& key, int bitOffset, std::shared_ptr<Node> &newRoot) {
+		Node* next = getChild(storage, key, bitOffset);
 		if (next) {
 			if (next == this) {
-				std::shared_ptr<Node> node = std::make_shared<Node>();
-				node->storage = storage;
-				*node = *this;
-				newRoot = node;
-				return node.get();
+				newRoot = copy();
+				return newRoot.get();
 			}
 			else {
-				Node *leaf = next->insert(key, bitOffset, newRoot);
+				Node *leaf = next->insert(storage, key, bitOffset, newRoot);
 				if (leaf) {
 					if (type == Type::BRANCH) {
 						std::shared_ptr<Node> node = createBranch();
-						if (nodes[0].get() == next) {
-							node->nodes[0] = newRoot;
-							node->nodes[1] = nodes[1];
-							node->childs[1] = childs[1];
+						Branch* oldBranch = branch();
+						Branch* newBranch = node->branch();
+						if (oldBranch->nodes[0].get() == next) {
+							newBranch->nodes[0] = newRoot;
+							newBranch->nodes[1] = oldBranch->nodes[1];
+							newBranch->childs[1] = oldBranch->childs[1];
 						}
-						else if (nodes[1].get() == next) {
-							node->nodes[1] = newRoot;
-							node->nodes[0] = nodes[0];
-							node->childs[0] = childs[0];
+						else if (oldBranch->nodes[1].get() == next) {
+							newBranch->nodes[1] = newRoot;
+							newBranch->nodes[0] = oldBranch->nodes[0];
+							newBranch->childs[0] = oldBranch->childs[0];
 						}
 						newRoot = node;
 					}
 					else if(type == Type::EXTENSION){
-						std::shared_ptr<Node> node = std::make_shared<Node>();
-						node->storage = storage;
-						*node = *this;
-						node->childs[0] = Hash(0);
-						node->nodes[0] = newRoot;
+						std::shared_ptr<Node> node = copy();
+						node->extension()->child = Hash(0);
+						node->extension()->node = newRoot;
 						newRoot = node;
 					}
 				}
@@ -329,65 +437,56 @@ public:
 				return newRoot.get();
 			}
 			else if (type == Type::EXTENSION || type == Type::LEAF) {
+				Key& path = type == Type::LEAF ? leaf()->path : extension()->path;
 				int match = path.bitMatch(key, bitOffset);
 
 				std::shared_ptr<Node> newBranch = createBranch();
 
 				if (match > 0) {
 					std::shared_ptr<Node> newExtension = createExtension(key, bitOffset, match);
-					newExtension->nodes[0] = newBranch;
+					newExtension->extension()->node = newBranch;
 					newRoot = newExtension;
 				}
 				else {
 					newRoot = newBranch;
 				}
 
-				std::shared_ptr<Node> oldLeaf = std::make_shared<Node>();
-				oldLeaf->storage = storage;
+				std::shared_ptr<Node> oldLeaf;
 				if (type == Type::LEAF) {
-					oldLeaf->type = Type::LEAF;
+					oldLeaf = create(Type::LEAF);
 					oldLeaf->pathLength = pathLength - match - 1;
-					for (int i = 0; i < oldLeaf->pathLength; i++) {
-						oldLeaf->path.setBit(i, path.getBit(i + match + 1));
-					}
-					oldLeaf->value = value;
+					oldLeaf->leaf()->path.copyBits(path, match + 1, oldLeaf->pathLength);
+					oldLeaf->leaf()->value = leaf()->value;
 				}
 				else {
-
-					if(nodes[0] == nullptr){
-						if (childs[0] == Hash(0)) {
+					Extension* node = extension();
+					if(node->node == nullptr){
+						if (node->child == Hash(0)) {
 							return nullptr;
 						}
-						else {
-							auto node = std::make_shared<Node>();
-							node->storage = storage;
-							node->load(childs[0]);
-							nodes[0] = node;
-						}
+						node->node = load(storage, node->child);
 					}
 
 					if (pathLength <= match + 1) {
-						oldLeaf = nodes[0];
+						oldLeaf = node->node;
 					}
 					else {
-						oldLeaf->type = Type::EXTENSION;
+						oldLeaf = create(Type::EXTENSION);
 						oldLeaf->pathLength = pathLength - match - 1;
-						for (int i = 0; i < oldLeaf->pathLength; i++) {
-							oldLeaf->path.setBit(i, path.getBit(i + match + 1));
-						}
-						oldLeaf->childs[0] = childs[0];
-						oldLeaf->nodes[0] = nodes[0];
+						oldLeaf->extension()->path.copyBits(path, match + 1, oldLeaf->pathLength);
+						oldLeaf->extension()->child = node->child;
+						oldLeaf->extension()->node = node->node;
 					}
 				}
 
 				std::shared_ptr<Node> newLeaf = createLeaf(key, bitOffset + match + 1);
 				if (key.getBit(bitOffset + match)) {
-					newBranch->nodes[1] = newLeaf;
-					newBranch->nodes[0] = oldLeaf;
+					newBranch->branch()->nodes[1] = newLeaf;
+					newBranch->branch()->nodes[0] = oldLeaf;
 				}
 				else {
-					newBranch->nodes[0] = newLeaf;
-					newBranch->nodes[1] = oldLeaf;
+					newBranch->branch()->nodes[0] = newLeaf;
+					newBranch->branch()->nodes[1] = oldLeaf;
 				}
 
 				return newLeaf.get();
@@ -395,4 +494,212 @@ public:
 		}
 		return nullptr;
 	}
+
+	//like insert, but nodes that are only owned by their parent are changed in place, node is replaced by its copy otherwise
+	static Node* insertInPlace(KeyValueStorage* storage, const Key& key, int bitOffset, std::shared_ptr<Node>& node) {
+		if (node.use_count() == 1) {
+			if (node->type == Type::BRANCH) {
+				bool bit = key.getBit(bitOffset);
+				Branch* branch = node->branch();
+				if (branch->nodes[bit] || branch->childs[bit] != Hash(0)) {
+					if (!branch->nodes[bit]) {
+						branch->nodes[bit] = load(storage, branch->childs[bit]);
+					}
+					Node* leaf = insertInPlace(storage, key, bitOffset + 1, branch->nodes[bit]);
+					if (leaf) {
+						branch->childs[bit] = Hash(0);
+					}
+					return leaf;
+				}
+			}
+			else if (node->type == Type::LEAF) {
+				if (node->leaf()->path.bitMatch(key, bitOffset) >= node->pathLength) {
+					return node.get();
+				}
+			}
+			else if (node->type == Type::EXTENSION) {
+				Extension* extension = node->extension();
+				if (extension->path.bitMatch(key, bitOffset) >= node->pathLength) {
+					if (!extension->node) {
+						if (extension->child == Hash(0)) {
+							return nullptr;
+						}
+						extension->node = load(storage, extension->child);
+					}
+					Node* leaf = insertInPlace(storage, key, bitOffset + node->pathLength, extension->node);
+					if (leaf) {
+						extension->child = Hash(0);
+					}
+					return leaf;
+				}
+			}
+		}
+		std::shared_ptr<Node> newRoot;
+		Node* leaf = node->insert(storage, key, bitOffset, newRoot);
+		if (leaf) {
+			node = newRoot;
+		}
+		return leaf;
+	}
+
+	//removes the key from the subtree of node, result is set to the new subtree or to null if the subtree is empty now
+	//nodes on the path are copied like in insert, a branch that is left with one child is merged with that child and
+	//with an extension above it, so the tree has the same shape and root as if the key had never been inserted
+	//returns false if the key is not in the subtree
+	static bool remove(KeyValueStorage* storage, const Key& key, int bitOffset, Node* node, std::shared_ptr<Node>& result) {
+		if (node->type == Type::LEAF) {
+			if (node->leaf()->path.bitMatch(key, bitOffset) < node->pathLength) {
+				return false;
+			}
+			result = nullptr;
+			return true;
+		}
+		else if (node->type == Type::EXTENSION) {
+			Extension* extension = node->extension();
+			if (extension->path.bitMatch(key, bitOffset) < node->pathLength) {
+				return false;
+			}
+			if (!loadChild(storage, extension->child, extension->node)) {
+				return false;
+			}
+			std::shared_ptr<Node> child;
+			if (!remove(storage, key, bitOffset + node->pathLength, extension->node.get(), child)) {
+				return false;
+			}
+			result = child ? join(extension->path, node->pathLength, child, Hash(0)) : nullptr;
+			return true;
+		}
+		else if (node->type == Type::BRANCH) {
+			Branch* branch = node->branch();
+			bool bit = key.getBit(bitOffset);
+			if (!loadChild(storage, branch->childs[bit], branch->nodes[bit])) {
+				return false;
+			}
+			std::shared_ptr<Node> child;
+			if (!remove(storage, key, bitOffset + 1, branch->nodes[bit].get(), child)) {
+				return false;
+			}
+			if (child) {
+				result = node->copy();
+				result->branch()->nodes[bit] = child;
+				result->branch()->childs[bit] = Hash(0);
+				return true;
+			}
+			//the other child takes the place of the branch, with the bit of the branch in front of its path
+			if (!loadChild(storage, branch->childs[!bit], branch->nodes[!bit])) {
+				return false;
+			}
+			Key path;
+			path.setBit(0, !bit);
+			result = join(path, 1, branch->nodes[!bit], branch->childs[!bit]);
+			return true;
+		}
+		return false;
+	}
+
+private:
+	static bool loadChild(KeyValueStorage* storage, const Hash& hash, std::shared_ptr<Node>& node) {
+		if (!node) {
+			if (hash == Hash(0)) {
+				return false;
+			}
+			node = load(storage, hash);
+		}
+		return node->type != Type::NONE;
+	}
+
+	//creates the node for a path followed by the node child, hash is the hash of the child if it didn't change
+	static std::shared_ptr<Node> join(const Key& path, int pathLength, const std::shared_ptr<Node>& child, const Hash& hash) {
+		std::shared_ptr<Node> node;
+		if (child->type == Type::BRANCH) {
+			node = create(Type::EXTENSION);
+			node->extension()->path = path;
+			node->extension()->child = hash;
+			node->extension()->node = child;
+			node->pathLength = pathLength;
+			return node;
+		}
+		node = child->copy();
+		Key& nodePath = node->type == Type::LEAF ? node->leaf()->path : node->extension()->path;
+		Key childPath = nodePath;
+		nodePath = path;
+		for (int i = 0; i < child->pathLength; i += 64) {
+			int count = std::min(64, child->pathLength - i);
+			nodePath.setBits(pathLength + i, childPath.getBits(i, count), count);
+		}
+		node->pathLength = pathLength + child->pathLength;
+		return node;
+	}
+
+	static void getDirtyChild(int depth, Hash& hash, Node* node, std::vector<std::pair<Hash*, Node*>>& childs) {
+		if (hash == Hash(0) && node) {
+			if (depth <= 1) {
+				childs.push_back({ &hash, node });
+			}
+			else {
+				node->getDirtyChilds(depth - 1, childs);
+			}
+		}
+	}
+
+	//a hash of 0 means the child was changed and has to be hashed again, -1 means a child could not be loaded
+	bool calculateChildHash(KeyValueStorage* storage, KeyValueStorage::WriteBatch& batch, Hash& hash, std::shared_ptr<Node>& node) {
+		if (hash == Hash(0)) {
+			if (!node) {
+				return false;
+			}
+			hash = node->calculateHash(storage, batch);
+			if (hash == Hash(-1)) {
+				hash = Hash(0);
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+template<typename KeyType, typename ValueType, bool useSerial>
+class BinaryTreeBranch : public BinaryTreeNode<KeyType, ValueType, useSerial> {
+public:
+	typedef BinaryTreeNode<KeyType, ValueType, useSerial> Node;
+
+	Hash childs[2];
+	std::shared_ptr<Node> nodes[2];
+
+	BinaryTreeBranch() {
+		this->type = BinaryTreeNodeType::BRANCH;
+		childs[0] = 0;
+		childs[1] = 0;
+	}
+};
+
+template<typename KeyType, typename ValueType, bool useSerial>
+class BinaryTreeExtension : public BinaryTreeNode<KeyType, ValueType, useSerial> {
+public:
+	typedef BinaryTreeNode<KeyType, ValueType, useSerial> Node;
+	typedef BinaryTreeKey<KeyType> Key;
+
+	Key path;
+	Hash child;
+	std::shared_ptr<Node> node;
+
+	BinaryTreeExtension() {
+		this->type = BinaryTreeNodeType::EXTENSION;
+		child = 0;
+	}
+};
+
+template<typename KeyType, typename ValueType, bool useSerial>
+class BinaryTreeLeaf : public BinaryTreeNode<KeyType, ValueType, useSerial> {
+public:
+	typedef BinaryTreeNode<KeyType, ValueType, useSerial> Node;
+	typedef BinaryTreeKey<KeyType> Key;
+
+	Key path;
+	ValueType value;
+
+	BinaryTreeLeaf() {
+		this->type = BinaryTreeNodeType::LEAF;
+		value = ValueType();
+	}
 };
@@ -4,6 +4,7 @@
 
 #include "BlockChain.h"
 #include "util/hex.h"
+#include "util/log.h"
 #include <algorithm>
 
 void BlockChain::init(const std::string& directory) {
@@ -16,6 +17,20 @@ void BlockChain::init(const std::string& directory) {
 	transactionStorage.init(directory + "/transactions");
 	validatorTreeStorage.init(directory + "/validators");
 	validatorTree.init(&validatorTreeStorage);
+	validatorVector.init(&validatorTreeStorage);
+
+	configureStorage(blockStorage, config.blockStorage);
+	configureStorage(transactionStorage, config.transactionStorage);
+	configureStorage(accountTreeStorage, config.accountStorage);
+	configureStorage(validatorTreeStorage, config.validatorStorage);
+
+	AccountTree::Node::getCache().setCapacity(config.accountNodeCacheSize);
+	ValidatorTree::Node::getCache().setCapacity(config.validatorNodeCacheSize);
+
+	//trees created from these share the pool
+	hashPool.start();
+	accountTree.setHashPool(&hashPool);
+	validatorTree.setHashPool(&hashPool);
 
 	loadBlockList();
 	if (!hasBlock(config.genesisBlockHash)) {
@@ -27,11 +42,19 @@ void BlockChain::init(const std::string& directory) {
 
 	accountTree.reset(getBlock(getHeadBlock()).header.accountTreeRoot);
 	validatorTree.reset(getBlock(getHeadBlock()).header.validatorTreeRoot);
+	updateHeadAccounts();
 
 	loadMetaData();
 	loadPendingTransactions();
 }
 
+void BlockChain::configureStorage(KeyValueStorage& storage, const StorageConfig& storageConfig) {
+	storage.setDurability(storageConfig.durability, storageConfig.syncIntervalMilliseconds);
+	storage.setCacheSize(storageConfig.cacheSize);
+	storage.setCompaction(storageConfig.compactionIntervalSeconds, storageConfig.compactionBytesPerSecond);
+	storage.setCompression(storageConfig.compression, storageConfig.compressionCacheSize);
+}
+
 TransactionHeader BlockChain::getTransactionHeader(const Hash& hash) {
 	return getTransaction(hash).header;
 }
@@ -58,6 +81,30 @@ Block BlockChain::getBlock(const Hash& hash) {
 	return block;
 }
 
+std::vector<Transaction> BlockChain::getTransactions(const std::vector<Hash>& hashes) {
+	std::vector<std::string> values = transactionStorage.getMany(hashes);
+	std::vector<Transaction> transactions(hashes.size());
+	for (int i = 0; i < (int)hashes.size(); i++) {
+		if (!values[i].empty()) {
+			transactions[i].deserial(values[i]);
+			transactions[i].transactionHash = hashes[i];
+		}
+	}
+	return transactions;
+}
+
+std::vector<Block> BlockChain::getBlocks(const std::vector<Hash>& hashes) {
+	std::vector<std::string> values = blockStorage.getMany(hashes);
+	std::vector<Block> blocks(hashes.size());
+	for (int i = 0; i < (int)hashes.size(); i++) {
+		if (!values[i].empty()) {
+			blocks[i].deserial(values[i]);
+			blocks[i].blockHash = hashes[i];
+		}
+	}
+	return blocks;
+}
+
 void BlockChain::removeBlock(const Hash &hash){
 	blockStorage.remove(hash);
 	metaData.erase(hash);
@@ -83,6 +130,16 @@ void BlockChain::addTransaction(const Transaction& transaction) {
 	}
 }
 
+void BlockChain::addTransactions(const std::vector<Transaction>& transactions) {
+	KeyValueStorage::WriteBatch batch;
+	for (auto& transaction : transactions) {
+		if (!transactionStorage.has(transaction.transactionHash)) {
+			batch.set(transaction.transactionHash, transaction.serial());
+		}
+	}
+	transactionStorage.write(batch);
+}
+
 BlockMetaData BlockChain::getMetaData(const Hash& blockHash) {
 	if (blockHash == Hash(0) || blockHash == config.genesisBlockHash) {
 		BlockMetaData data;
@@ -115,6 +172,25 @@ const std::set<Hash>& BlockChain::getPendingTransactions() {
 	return pendingTransactions;
 }
 
+std::vector<StorageStats> BlockChain::getStorageStats() {
+	std::vector<StorageStats> stats;
+	stats.push_back({ "blocks", blockStorage.getCacheStats() });
+	stats.push_back({ "transactions", transactionStorage.getCacheStats() });
+	stats.push_back({ "accounts", accountTreeStorage.getCacheStats() });
+	stats.push_back({ "validators", validatorTreeStorage.getCacheStats() });
+	stats.push_back({ "account nodes", AccountTree::Node::getCache().getStats() });
+	stats.push_back({ "validator nodes", ValidatorTree::Node::getCache().getStats() });
+
+	//the table holds every account of the head state, so its size is reported as both the usage and the capacity
+	std::shared_lock<std::shared_mutex> lock(headAccountMutex);
+	StorageCacheStats accounts;
+	accounts.entries = headAccounts.size();
+	accounts.bytes = headAccounts.size() * (sizeof(std::pair<const EccPublicKey, Account>) + 2 * sizeof(void*)) + headAccounts.bucket_count() * sizeof(void*);
+	accounts.capacity = accounts.bytes;
+	stats.push_back({ "head accounts", accounts });
+	return stats;
+}
+
 bool BlockChain::setHeadBlock(const Hash& blockHash) {
 	uint64_t commonBlockNumber = 0;
 	std::vector<Hash> newChain;
@@ -123,6 +199,7 @@ bool BlockChain::setHeadBlock(const Hash& blockHash) {
 		blockList.resize(0);
 		blockList.push_back(config.genesisBlockHash);
 		saveBlockList();
+		updateHeadAccounts();
 		return true;
 	}
 
@@ -154,6 +231,7 @@ bool BlockChain::setHeadBlock(const Hash& blockHash) {
 	}
 
 	saveBlockList();
+	updateHeadAccounts();
 	return true;
 }
 
@@ -183,10 +261,191 @@ AccountTree BlockChain::getAccountTree() {
 	return accountTree.createInstance(getBlock(getHeadBlock()).header.accountTreeRoot);
 }
 
+Account BlockChain::getAccount(const EccPublicKey& address) {
+	{
+		std::shared_lock<std::shared_mutex> lock(headAccountMutex);
+		if (headAccountsValid) {
+			auto i = headAccounts.find(address);
+			if (i != headAccounts.end()) {
+				return i->second;
+			}
+			return Account();
+		}
+	}
+	return getAccountTree().get(address);
+}
+
+//a reorg is handled the same way as a new block, only the accounts that differ between the two roots are changed
+//the changes are collected without the lock, so reads only wait while they are applied
+void BlockChain::updateHeadAccounts() {
+	std::unique_lock<std::mutex> updateLock(headAccountUpdateMutex);
+	Hash root = getBlockHeader(getHeadBlock()).accountTreeRoot;
+	Hash oldRoot;
+	bool valid;
+	{
+		std::shared_lock<std::shared_mutex> lock(headAccountMutex);
+		if (headAccountsValid && root == headAccountRoot) {
+			return;
+		}
+		oldRoot = headAccountRoot;
+		valid = headAccountsValid;
+	}
+
+	std::unordered_map<EccPublicKey, Account, AddressHash> accounts;
+	bool complete = false;
+	if (valid) {
+		std::vector<std::pair<EccPublicKey, Account>> changed;
+		std::vector<EccPublicKey> removed;
+		complete = accountTree.diff(oldRoot, root, [&](const EccPublicKey& address, const Account*, const Account* newAccount) {
+			if (newAccount) {
+				changed.push_back({ address, *newAccount });
+			}
+			else {
+				removed.push_back(address);
+			}
+		});
+		if (complete) {
+			std::unique_lock<std::shared_mutex> lock(headAccountMutex);
+			for (auto& i : changed) {
+				headAccounts[i.first] = i.second;
+			}
+			for (auto& address : removed) {
+				headAccounts.erase(address);
+			}
+			headAccountRoot = root;
+			return;
+		}
+	}
+	else {
+		//the first load reads every account once, the iterator doesn't put those nodes into the node cache
+		AccountTree tree = getAccountTree(root);
+		if (tree.getRoot() == root) {
+			auto i = tree.begin();
+			for (; i.valid(); i.next()) {
+				accounts[i.key()] = i.value();
+			}
+			complete = !i.failed();
+		}
+	}
+
+	if (!complete) {
+		accounts.clear();
+	}
+	{
+		std::unique_lock<std::shared_mutex> lock(headAccountMutex);
+		//the old table is freed after the lock is released
+		headAccounts.swap(accounts);
+		headAccountRoot = root;
+		headAccountsValid = complete;
+	}
+	if (!complete) {
+		//reads go to the tree until a later head can be loaded completely
+		log(LogLevel::WARNING, "BlockChain", "account nodes of root %s are missing, head accounts are read from the tree", toHex(root).c_str());
+	}
+}
+
 ValidatorTree BlockChain::getValidatorTree(const Hash& root) {
 	return validatorTree.createInstance(root);
 }
 
+ValidatorSet BlockChain::getValidatorSet(const BlockHeader& prev, uint32_t version) {
+	ValidatorSet set;
+	set.dense = version >= config.validatorVectorVersion;
+	set.removeEmpty = version >= config.treeRemoveVersion;
+	if (!set.dense) {
+		set.tree = validatorTree.createInstance(prev.validatorTreeRoot);
+	}
+	else if (prev.version >= config.validatorVectorVersion) {
+		set.vector = validatorVector.createInstance(prev.validatorTreeRoot);
+	}
+	else {
+		//the previous block still has the tree, all validators are copied once
+		ValidatorTree tree = validatorTree.createInstance(prev.validatorTreeRoot);
+		set.vector = validatorVector.createInstance(Hash(0));
+		uint64_t count = prev.totalStakeAmount / config.minimumStakeAmount;
+		for (uint64_t i = 0; i < count; i++) {
+			set.vector.pushBack(tree.get(i));
+		}
+	}
+	return set;
+}
+
+EccPublicKey BlockChain::getValidator(const BlockHeader& block, uint64_t validatorNumber) {
+	if (block.version >= config.validatorVectorVersion) {
+		return validatorVector.get(block.validatorTreeRoot, validatorNumber);
+	}
+	return validatorTree.createInstance(block.validatorTreeRoot).get(validatorNumber);
+}
+
+EccPublicKey ValidatorSet::get(uint64_t number) {
+	if (dense) {
+		return vector.get(number);
+	}
+	return tree.get(number);
+}
+
+void ValidatorSet::set(uint64_t number, const EccPublicKey& address) {
+	if (dense) {
+		vector.set(number, address);
+	}
+	else {
+		tree.set(number, address);
+	}
+}
+
+void ValidatorSet::clear(uint64_t number) {
+	if (dense) {
+		vector.swapRemove(number);
+	}
+	else if (removeEmpty) {
+		tree.remove(number);
+	}
+	else {
+		tree.set(number, EccPublicKey(0));
+	}
+}
+
+void ValidatorSet::beginBatch() {
+	if (dense) {
+		vector.beginBatch();
+	}
+	else {
+		tree.beginBatch();
+	}
+}
+
+Hash ValidatorSet::commit() {
+	if (dense) {
+		return vector.commit();
+	}
+	return tree.commit();
+}
+
+int ValidatorSet::checkpoint() {
+	if (dense) {
+		return vector.checkpoint();
+	}
+	return tree.checkpoint();
+}
+
+void ValidatorSet::revert(int checkpoint) {
+	if (dense) {
+		vector.revert(checkpoint);
+	}
+	else {
+		tree.revert(checkpoint);
+	}
+}
+
+void ValidatorSet::release(int checkpoint) {
+	if (dense) {
+		vector.release(checkpoint);
+	}
+	else {
+		tree.release(checkpoint);
+	}
+}
+
 void BlockChain::loadBlockList() {
 	std::ifstream stream(directory + "/chain.dat");
 	blockList.clear();
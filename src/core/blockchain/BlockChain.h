@@ -5,12 +5,38 @@
 #pragma once
 
 #include "BlockChainConfig.h"
-#include "BinaryTree.h"
+#include "MerkleTrie.h"
+#include "MerkleVector.h"
 #include "Consensus.h"
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
 
-typedef BinaryTree<uint64_t, EccPublicKey, false> ValidatorTree;
+typedef MerkleTrie<uint64_t, EccPublicKey, false, 1> ValidatorTree;
+typedef MerkleVector<EccPublicKey> ValidatorVector;
+
+//the validators of a block, either in the tree or in the vector depending on the block version
+//validator numbers are dense, so in the vector the last slot is removed instead of cleared
+class ValidatorSet {
+public:
+	ValidatorTree tree;
+	ValidatorVector vector;
+	bool dense = false;
+	//unused slots are removed from the tree
+	bool removeEmpty = false;
+
+	EccPublicKey get(uint64_t number);
+	void set(uint64_t number, const EccPublicKey& address);
+	//frees the slot of the last validator
+	void clear(uint64_t number);
+	void beginBatch();
+	Hash commit();
+	int checkpoint();
+	void revert(int checkpoint);
+	void release(int checkpoint);
+};
 
 class BlockMetaData {
 public:
@@ -18,6 +44,12 @@ public:
 	uint64_t received;
 };
 
+class StorageStats {
+public:
+	std::string name;
+	StorageCacheStats cache;
+};
+
 class BlockChain {
 public:
 	BlockChainConfig config;
@@ -32,12 +64,20 @@ public:
 	Hash getBlockHash(int blockNumber);
 	AccountTree getAccountTree(const Hash& root);
 	AccountTree getAccountTree();
+	//the account in the state of the head block, read from a table that follows the head instead of walking the tree
+	Account getAccount(const EccPublicKey& address);
 	ValidatorTree getValidatorTree(const Hash& root);
+	//the validators for a block of the given version that follows prev
+	ValidatorSet getValidatorSet(const BlockHeader& prev, uint32_t version);
+	EccPublicKey getValidator(const BlockHeader& block, uint64_t validatorNumber);
 
 	TransactionHeader getTransactionHeader(const Hash& hash);
 	Transaction getTransaction(const Hash& hash);
 	BlockHeader getBlockHeader(const Hash& hash);
 	Block getBlock(const Hash &hash);
+	//reads all transactions or blocks in one pass over the storage
+	std::vector<Transaction> getTransactions(const std::vector<Hash>& hashes);
+	std::vector<Block> getBlocks(const std::vector<Hash>& hashes);
 	void removeBlock(const Hash &hash);
 
 	bool hasBlock(const Hash& hash);
@@ -45,6 +85,7 @@ public:
 
 	void addBlock(const Block& block);
 	void addTransaction(const Transaction& transaction);
+	void addTransactions(const std::vector<Transaction>& transactions);
 
 	BlockMetaData getMetaData(const Hash& blockHash);
 	void setMetaData(const Hash& blockHash, BlockMetaData data);
@@ -53,22 +94,44 @@ public:
 	void removePendingTransaction(const Hash& transactionHash);
 	const std::set<Hash>& getPendingTransactions();
 
+	std::vector<StorageStats> getStorageStats();
 
 private:
+	//the first byte of a compressed key is only the sign, the x coordinate after it is already uniformly distributed
+	class AddressHash {
+	public:
+		size_t operator()(const EccPublicKey& address) const {
+			uint64_t value;
+			memcpy(&value, address.bytes + 1, sizeof(value));
+			return value;
+		}
+	};
+
 	std::string directory;
 
 	KeyValueStorage transactionStorage;
 	KeyValueStorage blockStorage;
 	KeyValueStorage accountTreeStorage;
 	KeyValueStorage validatorTreeStorage;
+	ThreadPool hashPool;
 	AccountTree accountTree;
 	ValidatorTree validatorTree;
+	ValidatorVector validatorVector;
+	//the accounts of the head block, changed by the difference between the old and the new head root when the head moves
+	std::unordered_map<EccPublicKey, Account, AddressHash> headAccounts;
+	Hash headAccountRoot = Hash(0);
+	bool headAccountsValid = false;
+	std::shared_mutex headAccountMutex;
+	//one update at a time, the changes are computed outside of headAccountMutex
+	std::mutex headAccountUpdateMutex;
 	std::map<Hash, BlockMetaData> metaData;
 	std::set<Hash> pendingTransactions;
 
 	std::vector<Hash> blockList;
 	uint64_t blockListStartOffset;
 
+	void configureStorage(KeyValueStorage& storage, const StorageConfig& storageConfig);
+	void updateHeadAccounts();
 	void loadBlockList();
 	void saveBlockList();
 	void loadMetaData();
@@ -8,6 +8,21 @@
 #include "Block.h"
 #include "Account.h"
 #include "util/hex.h"
+#include "storage/KeyValueStorage.h"
+
+//settings that BlockChain::init applies to one of its storages
+class StorageConfig {
+public:
+	StorageDurability durability = StorageDurability::PERIODIC;
+	int syncIntervalMilliseconds = 1000;
+	uint64_t cacheSize = 16 * 1024 * 1024;
+	//seconds between background compactions, 0 turns them off
+	int compactionIntervalSeconds = 600;
+	uint64_t compactionBytesPerSecond = 16 * 1024 * 1024;
+	//sealed segments are compressed, the cache holds decompressed blocks
+	bool compression = false;
+	uint64_t compressionCacheSize = 32 * 1024 * 1024;
+};
 
 class BlockChainConfig {
 public:
@@ -20,6 +35,35 @@ public:
 	Block genesisBlock;
 	int slotTime;
 	int maxTransactionPerBlock;
+	//blocks from this version on remove empty accounts and unused validator slots from the trees,
+	//older blocks keep them as empty values, so the roots of existing chains don't change
+	uint32_t treeRemoveVersion;
+	//blocks from this version on store the validators in a merkle vector instead of a tree,
+	//the first such block copies the validators of the previous block into the vector
+	uint32_t validatorVectorVersion;
+
+	//the storages are set up with these in BlockChain::init, so they can be changed before that, e.g. for a wallet
+	StorageConfig blockStorage;
+	StorageConfig transactionStorage;
+	StorageConfig accountStorage;
+	StorageConfig validatorStorage;
+	//bytes of decoded tree nodes that are cached for all tree instances, the caches are process wide
+	uint64_t accountNodeCacheSize = 64 * 1024 * 1024;
+	uint64_t validatorNodeCacheSize = 8 * 1024 * 1024;
+
+	BlockChainConfig() {
+		blockStorage.cacheSize = 32 * 1024 * 1024;
+		transactionStorage.cacheSize = 32 * 1024 * 1024;
+		accountStorage.cacheSize = 128 * 1024 * 1024;
+		validatorStorage.cacheSize = 16 * 1024 * 1024;
+	}
+
+	//for archival nodes, old blocks and transactions are rarely read there and take less disk compressed
+	//reads from compressed segments are several times slower, the tree nodes are hashes that don't compress
+	void initArchival() {
+		blockStorage.compression = true;
+		transactionStorage.compression = true;
+	}
 
 	void initDevNet(AccountTree &accountTree) {
 		transactionVersion = 1;
@@ -29,14 +73,15 @@ public:
 		uniformStakeSize = true;
 		slotTime = 10;
 		maxTransactionPerBlock = 1000;
+		treeRemoveVersion = 2;
+		validatorVectorVersion = 2;
 
 		EccPublicKey genesisAddress = fromHex<EccPublicKey>("");
 		Account genesisAccount;
 		genesisAccount.transactionCount = 0;
 		genesisAccount.balance = coinToAmount("1000000000");
 
-		accountTree.reset();
-		accountTree.set(genesisAddress, genesisAccount);
+		accountTree.build({ { genesisAddress, genesisAccount } });
 
 		genesisBlock = Block();
 		genesisBlock.header.version = blockVersion;
@@ -6,6 +6,7 @@
 
 void BlockCreator::beginBlock(const EccPublicKey& validator, const EccPublicKey& beneficiary, uint32_t slot, uint64_t timestamp) {
 	block = Block();
+	transactions.clear();
 	BlockHeader prev = blockChain->getBlockHeader(blockChain->getHeadBlock());
 	block.header.version = blockChain->config.blockVersion;
 	block.header.timestamp = timestamp;
@@ -19,7 +20,10 @@ void BlockCreator::beginBlock(const EccPublicKey& validator, const EccPublicKey&
 	totalFees = 0;
 
 	accountTree = blockChain->getAccountTree(prev.accountTreeRoot);
-	validatorTree = blockChain->getValidatorTree(prev.validatorTreeRoot);
+	validators = blockChain->getValidatorSet(prev, block.header.version);
+	accountTree.beginBatch();
+	validators.beginBatch();
+	removeEmpty = block.header.version >= blockChain->config.treeRemoveVersion;
 }
 
 void BlockCreator::addTransaction(const Transaction& transaction) {
@@ -34,7 +38,7 @@ void BlockCreator::addTransaction(const Transaction& transaction) {
 	
 		Account recipient = accountTree.get(transaction.header.recipient);
 		recipient.balance += transaction.header.amount;
-		accountTree.set(transaction.header.recipient, recipient);
+		setAccount(accountTree, transaction.header.recipient, recipient, removeEmpty);
 	}
 	else if (transaction.header.type == TransactionType::STAKE) {
 		Account sender = accountTree.get(transaction.header.sender);
@@ -46,7 +50,7 @@ void BlockCreator::addTransaction(const Transaction& transaction) {
 		if (recipient.stakeAmount == 0) {
 			recipient.stakeBlockNumber = block.header.blockNumber;
 			recipient.validatorNumber = block.header.totalStakeAmount / blockChain->config.minimumStakeAmount;
-			validatorTree.set(recipient.validatorNumber, transaction.header.recipient);
+			validators.set(recipient.validatorNumber, transaction.header.recipient);
 		}
 		recipient.stakeAmount += transaction.header.amount;
 		recipient.stakeOwner = transaction.header.sender;
@@ -67,34 +71,37 @@ void BlockCreator::addTransaction(const Transaction& transaction) {
 			recipient.stakeOwner = EccPublicKey(0);
 			recipient.stakeBlockNumber = 0;
 
-			EccPublicKey lastAddress = validatorTree.get((block.header.totalStakeAmount / blockChain->config.minimumStakeAmount) - 1);
+			EccPublicKey lastAddress = validators.get((block.header.totalStakeAmount / blockChain->config.minimumStakeAmount) - 1);
 			Account lastAccount = accountTree.get(lastAddress);
-			validatorTree.set(recipient.validatorNumber, lastAddress);
-			validatorTree.set(lastAccount.validatorNumber, EccPublicKey(0));
+			validators.set(recipient.validatorNumber, lastAddress);
+			validators.clear(lastAccount.validatorNumber);
 			lastAccount.validatorNumber = recipient.validatorNumber;
 			accountTree.set(lastAddress, lastAccount);
 
 			recipient.validatorNumber = 0;
 		}
-		accountTree.set(transaction.header.recipient, recipient);
+		setAccount(accountTree, transaction.header.recipient, recipient, removeEmpty);
 
 		block.header.totalStakeAmount -= transaction.header.amount;
 	}
 
 	totalFees += transaction.header.fee;
-	blockChain->addTransaction(transaction);
+	transactions.push_back(transaction);
 }
 
 Block& BlockCreator::endBlock() {
 	Account beneficiary = accountTree.get(block.header.beneficiary);
 	beneficiary.balance += totalFees;
-	accountTree.set(block.header.beneficiary, beneficiary);
+	setAccount(accountTree, block.header.beneficiary, beneficiary, removeEmpty);
 	totalFees = 0;
 
+	blockChain->addTransactions(transactions);
+	transactions.clear();
+
 	block.header.transactionCount = block.transactionTree.transactionHashes.size();
 	block.header.transactionTreeRoot = block.transactionTree.calculateRoot();
-	block.header.accountTreeRoot = accountTree.getRoot();
-	block.header.validatorTreeRoot = validatorTree.getRoot();
+	block.header.accountTreeRoot = accountTree.commit();
+	block.header.validatorTreeRoot = validators.commit();
 	return block;
 }
 
@@ -16,7 +16,9 @@ public:
 
 private:
 	Block block;
+	std::vector<Transaction> transactions;
 	Amount totalFees;
 	AccountTree accountTree;
-	ValidatorTree validatorTree;
+	ValidatorSet validators;
+	bool removeEmpty = false;
 };
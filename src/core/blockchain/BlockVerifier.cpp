@@ -27,14 +27,35 @@ bool amountAdd(Amount& out, Amount lhs, Amount rhs) {
 	return true;
 }
 
+VerifyContext::Checkpoint VerifyContext::checkpoint() {
+	return { accountTree.checkpoint(), validators.checkpoint(), totalStakeAmount, totalFees };
+}
+
+void VerifyContext::revert(const Checkpoint& checkpoint) {
+	accountTree.revert(checkpoint.accounts);
+	validators.revert(checkpoint.validators);
+	totalStakeAmount = checkpoint.totalStakeAmount;
+	totalFees = checkpoint.totalFees;
+}
+
+void VerifyContext::release(const Checkpoint& checkpoint) {
+	accountTree.release(checkpoint.accounts);
+	validators.release(checkpoint.validators);
+}
+
 VerifyContext BlockVerifier::createContext(const Hash& blockHash) {
+	return createContext(blockHash, blockChain->config.blockVersion);
+}
+
+VerifyContext BlockVerifier::createContext(const Hash& blockHash, uint32_t version) {
 	Block prev = blockChain->getBlock(blockHash);
 	VerifyContext context;
 	context.blockNumber = prev.header.blockNumber + 1;
 	context.totalStakeAmount = prev.header.totalStakeAmount;
 	context.totalFees = 0;
 	context.accountTree = blockChain->getAccountTree(prev.header.accountTreeRoot);
-	context.validatorTree = blockChain->getValidatorTree(prev.header.validatorTreeRoot);
+	context.validators = blockChain->getValidatorSet(prev.header, version);
+	context.removeEmpty = version >= blockChain->config.treeRemoveVersion;
 	return context;
 }
 
@@ -43,7 +64,8 @@ BlockError BlockVerifier::verifyBlockHeader(const BlockHeader& block, uint64_t u
 		return BlockError::VALID;
 	}
 
-	if (block.version != blockChain->config.blockVersion) {
+	//blocks made before an upgrade keep their version
+	if (block.version == 0 || block.version > blockChain->config.blockVersion) {
 		return BlockError::INVALID_VERSION;
 	}
 	if (!eccValidPublicKey(block.beneficiary)) {
@@ -63,6 +85,10 @@ BlockError BlockVerifier::verifyBlockHeader(const BlockHeader& block, uint64_t u
 	if (block.blockNumber != prev.header.blockNumber + 1) {
 		return BlockError::INVALID_BLOCK_NUMBER;
 	}
+	//the trees of a version can't be changed with the rules of an older one
+	if (block.version < prev.header.version) {
+		return BlockError::INVALID_VERSION;
+	}
 
 	EccPublicKey selectedValidator = blockChain->consensus.selectNextValidator(prev.header, block.slot);
 	if (block.validator != selectedValidator && selectedValidator != EccPublicKey(0)) {
@@ -112,11 +138,14 @@ BlockError BlockVerifier::verifyBlock(const Block& block, uint64_t unixTime) {
 		return BlockError::INVALID_TRANSACTION_ROOT;
 	}
 
-	VerifyContext context = createContext(block.header.previousBlockHash);
-	
-	for (auto &h : block.transactionTree.transactionHashes) {
-		Transaction tx = blockChain->getTransaction(h);
-		if (tx.header.caclulateHash() != h) {
+	VerifyContext context = createContext(block.header.previousBlockHash, block.header.version);
+	context.accountTree.beginBatch();
+	context.validators.beginBatch();
+
+	std::vector<Transaction> transactions = blockChain->getTransactions(block.transactionTree.transactionHashes);
+	for (int i = 0; i < (int)transactions.size(); i++) {
+		Transaction &tx = transactions[i];
+		if (tx.header.caclulateHash() != block.transactionTree.transactionHashes[i]) {
 			return BlockError::TRANSACTION_NOT_FOUND;
 		}
 
@@ -131,7 +160,7 @@ BlockError BlockVerifier::verifyBlock(const Block& block, uint64_t unixTime) {
 	if (!amountAdd(beneficiaryAccount.balance, beneficiaryAccount.balance, context.totalFees)) {
 		return BlockError::INVALID_ACCOUNT_TREE_ROOT;
 	}
-	context.accountTree.set(block.header.beneficiary, beneficiaryAccount);
+	setAccount(context.accountTree, block.header.beneficiary, beneficiaryAccount, context.removeEmpty);
 
 	if(block.header.accountTreeRoot == Hash(-1)){
 		return BlockError::INVALID_ACCOUNT_TREE_ROOT;	
@@ -140,10 +169,10 @@ BlockError BlockVerifier::verifyBlock(const Block& block, uint64_t unixTime) {
 		return BlockError::INVALID_ACCOUNT_TREE_ROOT;	
 	}
 
-	if (context.accountTree.getRoot() != block.header.accountTreeRoot) {
+	if (context.accountTree.commit() != block.header.accountTreeRoot) {
 		return BlockError::INVALID_ACCOUNT_TREE_ROOT;
 	}
-	if (context.validatorTree.getRoot() != block.header.validatorTreeRoot) {
+	if (context.validators.commit() != block.header.validatorTreeRoot) {
 		return BlockError::INVALID_VALIDATOR_TREE_ROOT;
 	}
 	if (block.header.totalStakeAmount != context.totalStakeAmount) {
@@ -189,7 +218,7 @@ TransactionError BlockVerifier::verifyTransaction(const Transaction& transaction
 		if (!amountAdd(recipientAccount.balance, recipientAccount.balance, transaction.header.amount)) {
 			return TransactionError::INVALID_BALANCE;
 		}
-		context.accountTree.set(transaction.header.recipient, recipientAccount);
+		setAccount(context.accountTree, transaction.header.recipient, recipientAccount, context.removeEmpty);
 	}
 	else if (transaction.header.type == TransactionType::STAKE) {
 		Account senderAccount = context.accountTree.get(transaction.header.sender);
@@ -213,7 +242,7 @@ TransactionError BlockVerifier::verifyTransaction(const Transaction& transaction
 		if (recipientAccount.stakeAmount == 0) {
 			recipientAccount.stakeBlockNumber = context.blockNumber;
 			recipientAccount.validatorNumber = context.totalStakeAmount / blockChain->config.minimumStakeAmount;
-			context.validatorTree.set(recipientAccount.validatorNumber, transaction.header.recipient);
+			context.validators.set(recipientAccount.validatorNumber, transaction.header.recipient);
 		}
 
 		if (!amountAdd(recipientAccount.stakeAmount, recipientAccount.stakeAmount, transaction.header.amount)) {
@@ -259,17 +288,17 @@ TransactionError BlockVerifier::verifyTransaction(const Transaction& transaction
 			recipientAccount.stakeOwner = EccPublicKey(0);
 			recipientAccount.stakeBlockNumber = 0;
 			
-			EccPublicKey lastAddress = context.validatorTree.get((context.totalStakeAmount / blockChain->config.minimumStakeAmount)-1);
+			EccPublicKey lastAddress = context.validators.get((context.totalStakeAmount / blockChain->config.minimumStakeAmount)-1);
 			Account lastAccount = context.accountTree.get(lastAddress);
-			context.validatorTree.set(recipientAccount.validatorNumber, lastAddress);
-			context.validatorTree.set(lastAccount.validatorNumber, EccPublicKey(0));
+			context.validators.set(recipientAccount.validatorNumber, lastAddress);
+			context.validators.clear(lastAccount.validatorNumber);
 			lastAccount.validatorNumber = recipientAccount.validatorNumber;
 			context.accountTree.set(lastAddress, lastAccount);
 
 			recipientAccount.validatorNumber = 0;
 
 		}
-		context.accountTree.set(transaction.header.recipient, recipientAccount);
+		setAccount(context.accountTree, transaction.header.recipient, recipientAccount, context.removeEmpty);
 
 		Account senderAccount = context.accountTree.get(transaction.header.sender);
 		if (transaction.header.transactionNumber != senderAccount.transactionCount) {
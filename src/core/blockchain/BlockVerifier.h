@@ -16,7 +16,23 @@ public:
 	uint64_t totalStakeAmount;
 	Amount totalFees;
 	AccountTree accountTree;
-	ValidatorTree validatorTree;
+	ValidatorSet validators;
+	//empty accounts and unused validator slots are removed from the trees
+	bool removeEmpty = false;
+
+	class Checkpoint {
+	public:
+		int accounts;
+		int validators;
+		uint64_t totalStakeAmount;
+		Amount totalFees;
+	};
+
+	//the trees record the changes after a checkpoint, so a rejected transaction can be undone without copying the context
+	//every checkpoint has to be ended with revert or release, the innermost first
+	Checkpoint checkpoint();
+	void revert(const Checkpoint& checkpoint);
+	void release(const Checkpoint& checkpoint);
 };
 
 class BlockVerifier {
@@ -26,6 +42,8 @@ public:
 	//created verification context b ased on a block
 	//transactions might be valid in on block and invalid in another
 	VerifyContext createContext(const Hash& blockHash);
+	//the rules of the block version decide how the trees change, so a block is verified with the version it was created with
+	VerifyContext createContext(const Hash& blockHash, uint32_t version);
 
 	//verifies a block header, note that it is assumed that the previous block is valid
 	BlockError verifyBlockHeader(const BlockHeader& block, uint64_t unixTime);
@@ -23,7 +23,7 @@ EccPublicKey Consensus::selectNextValidator(const BlockHeader& block, uint32_t s
 		num = numMax - 1;
 	}
 
-	return blockChain->getValidatorTree(block.validatorTreeRoot).get(num);
+	return blockChain->getValidator(block, num);
 }
 
 bool Consensus::forkChoice(const BlockHeader& a, const BlockHeader& b) {
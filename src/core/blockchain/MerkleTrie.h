@@ -0,0 +1,17 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include "BinaryTree.h"
+#include "RadixTree.h"
+#include <type_traits>
+
+//the trie of a tree type, radixBits is the number of key bits that a branch consumes
+//1 is the BinaryTree, 4 and 8 are the 16 and 256 way RadixTree, the variants give different roots for the same content
+//proofs, iteration, diffs, removal and checkpoints only exist on the BinaryTree, so the tree types that use them stay at 1
+template<typename KeyType, typename ValueType, bool useSerial, int radixBits = 1>
+using MerkleTrie = typename std::conditional<radixBits == 1,
+	BinaryTree<KeyType, ValueType, useSerial>,
+	RadixTree<KeyType, ValueType, useSerial, radixBits>>::type;
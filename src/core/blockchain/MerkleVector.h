@@ -0,0 +1,376 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include "type.h"
+#include "storage/KeyValueStorage.h"
+#include "util/Serializer.h"
+#include "util/log.h"
+#include "cryptography/sha.h"
+#include <memory>
+#include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <type_traits>
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+
+//merkle commitment to an array of values with dense indices
+//the values are stored in chunks of chunkSize values and a balanced hash tree is built over the chunk hashes
+//get is an array access, set only rehashes the chunk and the log(n) tree hashes above it when the root is computed
+//chunks are shared between instances and copied on the first change, so an instance for the next block only copies pointers
+//the root is the hash of the size and the top of the hash tree, the chunks and a list of the chunk hashes are stored under their hashes
+template<typename T, int chunkSize = 64>
+class MerkleVector {
+public:
+	static_assert(std::is_trivially_copyable<T>::value, "MerkleVector stores the bytes of the values");
+	typedef MerkleVector<T, chunkSize> Vector;
+
+	void init(KeyValueStorage* storage, const Hash& root = Hash()) {
+		this->storage = storage;
+		cache = std::make_shared<Cache>();
+		reset(root);
+	}
+
+	bool reset(const Hash& root = Hash()) {
+		state = State();
+		rootHash = Hash(0);
+		if (root != Hash()) {
+			std::shared_ptr<const State> loaded = getState(root);
+			if (loaded) {
+				state = *loaded;
+				rootHash = root;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	uint64_t size() const {
+		return state.size;
+	}
+
+	bool has(uint64_t index) const {
+		return index < state.size;
+	}
+
+	//indices past the end result in T()
+	T get(uint64_t index) const {
+		if (index >= state.size) {
+			return T();
+		}
+		return state.chunks[index / chunkSize]->values[index % chunkSize];
+	}
+
+	//the value of a committed root, without creating an instance, the decoded roots are cached
+	T get(const Hash& root, uint64_t index) {
+		std::shared_ptr<const State> loaded = getState(root);
+		if (!loaded || index >= loaded->size) {
+			return T();
+		}
+		return loaded->chunks[index / chunkSize]->values[index % chunkSize];
+	}
+
+	//an index past the end grows the vector, the values in between are T()
+	void set(uint64_t index, const T& value) {
+		if (!checkpoints.empty()) {
+			journal.push_back({ state.size, index, get(index) });
+		}
+		write(index, value);
+	}
+
+	void pushBack(const T& value) {
+		set(state.size, value);
+	}
+
+	void popBack() {
+		if (state.size > 0) {
+			if (!checkpoints.empty()) {
+				journal.push_back({ state.size, state.size - 1, get(state.size - 1) });
+			}
+			resize(state.size - 1);
+		}
+	}
+
+	//moves the last value to index and removes the last slot, so the indices stay dense
+	void swapRemove(uint64_t index) {
+		if (index >= state.size) {
+			return;
+		}
+		if (index != state.size - 1) {
+			set(index, get(state.size - 1));
+		}
+		popBack();
+	}
+
+	//the same as for the trees, changes after a checkpoint record the old value and size, so they can be reverted
+	int checkpoint() {
+		checkpoints.push_back(journal.size());
+		return journal.size();
+	}
+
+	void revert(int checkpoint) {
+		while ((int)journal.size() > checkpoint) {
+			Change& change = journal.back();
+			resize(change.size);
+			if (change.index < change.size) {
+				write(change.index, change.value);
+			}
+			journal.pop_back();
+		}
+		release(checkpoint);
+	}
+
+	void release(int checkpoint) {
+		//ending an outer checkpoint first would keep changes that an inner revert expects to undo
+		if (checkpoints.empty() || checkpoints.back() != checkpoint || checkpoint > (int)journal.size()) {
+			log(LogLevel::FATAL, "MerkleVector", "checkpoint %i is not the innermost open checkpoint", checkpoint);
+			abort();
+		}
+		checkpoints.pop_back();
+		if (checkpoints.empty()) {
+			journal.clear();
+		}
+	}
+
+	//the same interface as the trees, changes are always made in place
+	void beginBatch() {}
+
+	Hash commit() {
+		return getRoot();
+	}
+
+	Hash getRoot() {
+		if (rootHash == Hash(0) && state.size > 0) {
+			KeyValueStorage::WriteBatch batch;
+			std::vector<Hash>& hashes = state.levels[0];
+			for (int i = 0; i < (int)hashes.size(); i++) {
+				if (hashes[i] == Hash(0)) {
+					std::string data((char*)state.chunks[i]->values, sizeof(Chunk::values));
+					hashes[i] = sha256(data);
+					if (!storage->has(hashes[i])) {
+						batch.set(hashes[i], data);
+					}
+				}
+			}
+			for (int level = 1; level < (int)state.levels.size(); level++) {
+				std::vector<Hash>& below = state.levels[level - 1];
+				for (int i = 0; i < (int)state.levels[level].size(); i++) {
+					if (state.levels[level][i] == Hash(0)) {
+						state.levels[level][i] = hashPair(below[i * 2], i * 2 + 1 < (int)below.size() ? below[i * 2 + 1] : Hash(0));
+					}
+				}
+			}
+
+			Serializer serial;
+			serial.write(state.size);
+			serial.write(state.levels.back()[0]);
+			rootHash = sha256(serial.toString());
+
+			//the root record lists the chunk hashes, so a root can be loaded without the inner hashes
+			Serializer record;
+			record.write(state.size);
+			for (auto& hash : hashes) {
+				record.write(hash);
+			}
+			batch.set(rootHash, record.toString());
+			storage->write(batch);
+			addState(rootHash, std::make_shared<State>(state));
+		}
+		return rootHash;
+	}
+
+	Vector createInstance(const Hash& root) {
+		Vector instance;
+		instance.storage = storage;
+		instance.cache = cache;
+		instance.reset(root);
+		return instance;
+	}
+
+	//number of decoded roots that are kept for createInstance and get
+	void setCacheSize(int count) {
+		std::unique_lock<std::mutex> lock(cache->mutex);
+		cache->capacity = count;
+	}
+
+private:
+	class Chunk {
+	public:
+		T values[chunkSize];
+
+		Chunk() {
+			for (int i = 0; i < chunkSize; i++) {
+				values[i] = T();
+			}
+		}
+	};
+
+	class State {
+	public:
+		uint64_t size = 0;
+		std::vector<std::shared_ptr<Chunk>> chunks;
+		//levels[0] are the chunk hashes, the last level is the top hash, Hash(0) marks a hash that has to be computed
+		std::vector<std::vector<Hash>> levels;
+	};
+
+	//states of recently used roots, the chunks are shared with the instances and never changed while shared
+	class Cache {
+	public:
+		std::mutex mutex;
+		std::list<Hash> lru;
+		std::map<Hash, std::pair<std::shared_ptr<const State>, std::list<Hash>::iterator>> states;
+		int capacity = 16;
+	};
+
+	//the size before the change and the old value of the changed index
+	class Change {
+	public:
+		uint64_t size;
+		uint64_t index;
+		T value;
+	};
+
+	KeyValueStorage* storage = nullptr;
+	std::shared_ptr<Cache> cache;
+	State state;
+	Hash rootHash;
+	std::vector<Change> journal;
+	std::vector<int> checkpoints;
+
+	void write(uint64_t index, const T& value) {
+		if (index >= state.size) {
+			resize(index + 1);
+		}
+		getChunk(index / chunkSize)->values[index % chunkSize] = value;
+		invalidate(index / chunkSize);
+	}
+
+	static Hash hashPair(const Hash& left, const Hash& right) {
+		Serializer serial;
+		serial.write(left);
+		serial.write(right);
+		return sha256(serial.toString());
+	}
+
+	Chunk* getChunk(uint64_t index) {
+		std::shared_ptr<Chunk>& chunk = state.chunks[index];
+		if (chunk.use_count() > 1) {
+			chunk = std::make_shared<Chunk>(*chunk);
+		}
+		return chunk.get();
+	}
+
+	//marks the chunk and the hashes above it as changed
+	void invalidate(uint64_t index) {
+		for (auto& level : state.levels) {
+			level[index] = Hash(0);
+			index /= 2;
+		}
+		rootHash = Hash(0);
+	}
+
+	void resize(uint64_t size) {
+		//removed values are set to T(), so the last chunk hashes the same as if they were never set
+		for (uint64_t i = size; i < state.size; i++) {
+			getChunk(i / chunkSize)->values[i % chunkSize] = T();
+			invalidate(i / chunkSize);
+		}
+		uint64_t chunkCount = (size + chunkSize - 1) / chunkSize;
+		uint64_t oldCount = state.chunks.size();
+		state.chunks.resize(chunkCount);
+		for (uint64_t i = oldCount; i < chunkCount; i++) {
+			state.chunks[i] = std::make_shared<Chunk>();
+		}
+		state.size = size;
+		rootHash = Hash(0);
+
+		if (chunkCount != oldCount) {
+			//only the hashes at the end of every level get different children, new hashes start as changed
+			std::vector<std::vector<Hash>> levels;
+			for (uint64_t count = chunkCount; count > 0; count = count == 1 ? 0 : (count + 1) / 2) {
+				std::vector<Hash> level(count, Hash(0));
+				int index = levels.size();
+				if (index < (int)state.levels.size() && state.levels[index].size() > 1) {
+					//the old last hash was padded or had fewer children, so it is not copied
+					std::copy_n(state.levels[index].begin(), std::min<uint64_t>(count, state.levels[index].size() - 1), level.begin());
+				}
+				level.back() = Hash(0);
+				levels.push_back(level);
+			}
+			state.levels = levels;
+		}
+	}
+
+	std::shared_ptr<const State> getState(const Hash& root) {
+		{
+			std::unique_lock<std::mutex> lock(cache->mutex);
+			auto i = cache->states.find(root);
+			if (i != cache->states.end()) {
+				cache->lru.splice(cache->lru.begin(), cache->lru, i->second.second);
+				return i->second.first;
+			}
+		}
+		std::shared_ptr<State> loaded = load(root);
+		if (loaded) {
+			addState(root, loaded);
+		}
+		return loaded;
+	}
+
+	void addState(const Hash& root, const std::shared_ptr<const State>& loaded) {
+		std::unique_lock<std::mutex> lock(cache->mutex);
+		if (cache->states.count(root)) {
+			return;
+		}
+		cache->lru.push_front(root);
+		cache->states[root] = { loaded, cache->lru.begin() };
+		while ((int)cache->states.size() > cache->capacity) {
+			cache->states.erase(cache->lru.back());
+			cache->lru.pop_back();
+		}
+	}
+
+	std::shared_ptr<State> load(const Hash& root) {
+		std::string data = storage->get(root);
+		if (data.size() < sizeof(uint64_t)) {
+			return nullptr;
+		}
+		Serializer serial(data);
+		std::shared_ptr<State> loaded = std::make_shared<State>();
+		serial.read(loaded->size);
+		uint64_t chunkCount = (loaded->size + chunkSize - 1) / chunkSize;
+		if (data.size() != sizeof(uint64_t) + chunkCount * sizeof(Hash)) {
+			return nullptr;
+		}
+		std::vector<Hash> hashes(chunkCount);
+		for (auto& hash : hashes) {
+			serial.read(hash);
+		}
+
+		std::vector<std::string> values = storage->getMany(hashes);
+		for (auto& value : values) {
+			if (value.size() != sizeof(Chunk::values)) {
+				return nullptr;
+			}
+			std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+			memcpy((void*)chunk->values, value.data(), value.size());
+			loaded->chunks.push_back(chunk);
+		}
+
+		loaded->levels.push_back(hashes);
+		while (loaded->levels.back().size() > 1) {
+			std::vector<Hash>& below = loaded->levels.back();
+			std::vector<Hash> level((below.size() + 1) / 2);
+			for (int i = 0; i < (int)level.size(); i++) {
+				level[i] = hashPair(below[i * 2], i * 2 + 1 < (int)below.size() ? below[i * 2 + 1] : Hash(0));
+			}
+			loaded->levels.push_back(level);
+		}
+		return loaded;
+	}
+};
@@ -232,17 +232,20 @@ void Network::onMessage(const std::string& msg, PeerId source) {
 				reply.write(count);
 
 				bool fail = false;
+				std::vector<Hash> hashes;
 				for (int i = 0; i < count; i++) {
 					Hash hash = request.read<Hash>();
 					if (!blockChain->hasBlock(hash)) {
 						fail = true;
 						break;
 					}
-					Block block = blockChain->getBlock(hash);
-					std::string data = block.serial();
-					reply.writeStr(data);
+					hashes.push_back(hash);
 				}
 				if (!fail) {
+					for (auto& block : blockChain->getBlocks(hashes)) {
+						std::string data = block.serial();
+						reply.writeStr(data);
+					}
 					network.send(source, reply.toString());
 					return;
 				}
@@ -258,17 +261,20 @@ void Network::onMessage(const std::string& msg, PeerId source) {
 				reply.write(count);
 
 				bool fail = false;
+				std::vector<Hash> hashes;
 				for (int i = 0; i < count; i++) {
 					Hash hash = request.read<Hash>();
 					if (!blockChain->hasTransaction(hash)) {
 						fail = true;
 						break;
 					}
-					Transaction transaction = blockChain->getTransaction(hash);
-					std::string data = transaction.serial();
-					reply.writeStr(data);
+					hashes.push_back(hash);
 				}
 				if (!fail) {
+					for (auto& transaction : blockChain->getTransactions(hashes)) {
+						std::string data = transaction.serial();
+						reply.writeStr(data);
+					}
 					network.send(source, reply.toString());
 					return;
 				}
@@ -286,6 +292,25 @@ void Network::onMessage(const std::string& msg, PeerId source) {
 			network.send(source, reply.toString());
 			return;
 		}
+		else if (opcode == NetworkOpcode::ACCOUNT_PROOF_REQUEST) {
+			Hash treeRoot = request.read<Hash>();
+			EccPublicKey address = request.read<EccPublicKey>();
+
+			//a root that doesn't load gives an empty tree, which would prove that every account is missing
+			AccountTree tree = blockChain->getAccountTree(treeRoot);
+			std::string proof;
+			if (tree.getRoot() == treeRoot) {
+				proof = tree.getProof(address);
+			}
+			if (!proof.empty()) {
+				Serializer reply;
+				reply.write(NetworkOpcode::ACCOUNT_PROOF_REPLY);
+				reply.write(requestId);
+				reply.writeBytes((uint8_t*)proof.data(), proof.size());
+				network.send(source, reply.toString());
+				return;
+			}
+		}
 		else if (opcode == NetworkOpcode::PENDING_TRANSACTIONS_REQUEST) {
 			int count = blockChain->getPendingTransactions().size();
 			Serializer reply;
@@ -28,6 +28,8 @@ enum class NetworkOpcode {
 	TRANSACTION_BROADCAST,
 	REQUEST_ERROR,
 	TIMEOUT,
+	ACCOUNT_PROOF_REQUEST,
+	ACCOUNT_PROOF_REPLY,
 };
 
 enum class NetworkState {
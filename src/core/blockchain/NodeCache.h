@@ -0,0 +1,146 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include "type.h"
+#include "storage/StorageCache.h"
+#include <unordered_map>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstring>
+
+//process wide cache of decoded tree nodes with a memory budget, shared by all trees with the same node type
+//nodes are addressed by the hash of their content, so a cached node is valid for every storage
+//cached nodes are never changed, trees get copies of them to load their children into
+template<typename Node>
+class NodeCache {
+public:
+	NodeCache(uint64_t capacity = 16 * 1024 * 1024, int shardCount = 16) {
+		for (int i = 0; i < shardCount; i++) {
+			shards.push_back(std::make_unique<Shard>());
+		}
+		setCapacity(capacity);
+	}
+
+	static NodeCache& getInstance() {
+		static NodeCache cache;
+		return cache;
+	}
+
+	std::shared_ptr<const Node> get(const Hash& hash) {
+		Shard& shard = getShard(hash);
+		std::unique_lock<std::mutex> lock(shard.mutex);
+		auto i = shard.entries.find(hash);
+		if (i == shard.entries.end()) {
+			shard.misses++;
+			return nullptr;
+		}
+		shard.hits++;
+		i->second.referenced = true;
+		return i->second.node;
+	}
+
+	void set(const Hash& hash, const std::shared_ptr<const Node>& node, uint64_t size) {
+		Shard& shard = getShard(hash);
+		std::unique_lock<std::mutex> lock(shard.mutex);
+		if (shard.entries.count(hash) || size > shard.capacity) {
+			return;
+		}
+		shard.entries[hash] = { node, size, false };
+		shard.queue.push_back(hash);
+		shard.bytes += size;
+		shard.evict();
+	}
+
+	void clear() {
+		for (auto& shard : shards) {
+			std::unique_lock<std::mutex> lock(shard->mutex);
+			shard->entries.clear();
+			shard->queue.clear();
+			shard->bytes = 0;
+		}
+	}
+
+	void setCapacity(uint64_t capacity) {
+		this->capacity = capacity;
+		for (auto& shard : shards) {
+			std::unique_lock<std::mutex> lock(shard->mutex);
+			shard->capacity = capacity / shards.size();
+			shard->evict();
+		}
+	}
+
+	StorageCacheStats getStats() {
+		StorageCacheStats stats;
+		stats.capacity = capacity;
+		for (auto& shard : shards) {
+			std::unique_lock<std::mutex> lock(shard->mutex);
+			stats.hits += shard->hits;
+			stats.misses += shard->misses;
+			stats.evictions += shard->evictions;
+			stats.entries += shard->entries.size();
+			stats.bytes += shard->bytes;
+		}
+		return stats;
+	}
+
+private:
+	class Entry {
+	public:
+		std::shared_ptr<const Node> node;
+		uint64_t size;
+		bool referenced;
+	};
+
+	//the keys are hashes already, so their first bytes are used as they are
+	class EntryHash {
+	public:
+		size_t operator()(const Hash& hash) const {
+			uint64_t value;
+			memcpy(&value, hash.bytes, sizeof(value));
+			return value;
+		}
+	};
+
+	//evicts in clock order, entries that were used since they were last looked at get another round
+	//a hit doesn't have to move anything, which matters because a lookup in a tree hits a node on every level
+	class Shard {
+	public:
+		std::mutex mutex;
+		std::deque<Hash> queue;
+		std::unordered_map<Hash, Entry, EntryHash> entries;
+		uint64_t bytes = 0;
+		uint64_t capacity = 0;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+
+		void evict() {
+			while (bytes > capacity && !queue.empty()) {
+				Hash hash = queue.front();
+				queue.pop_front();
+				auto i = entries.find(hash);
+				if (i->second.referenced) {
+					i->second.referenced = false;
+					queue.push_back(hash);
+				}
+				else {
+					bytes -= i->second.size;
+					entries.erase(i);
+					evictions++;
+				}
+			}
+		}
+	};
+
+	std::vector<std::unique_ptr<Shard>> shards;
+	uint64_t capacity;
+
+	Shard& getShard(const Hash& hash) {
+		return *shards[hash.bytes[8] % shards.size()];
+	}
+};
@@ -0,0 +1,149 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include "storage/KeyValueStorage.h"
+#include "util/ThreadPool.h"
+#include "RadixTreeNode.h"
+
+//merkle trie with the interface of BinaryTree that branches on digits of radixBits bits (16 way by default, 8 bits for 256 way)
+//the trie has fewer levels, so lookups load fewer nodes and updates hash fewer nodes, but the roots differ from a BinaryTree with the same content
+template<typename KeyType, typename ValueType, bool useSerial, int radixBits = 4>
+class RadixTree {
+public:
+	typedef RadixTreeNode<KeyType, ValueType, useSerial, radixBits> Node;
+	typedef RadixTree<KeyType, ValueType, useSerial, radixBits> Tree;
+	typedef BinaryTreeNodeType Type;
+
+	void init(KeyValueStorage* storage, const Hash &root = Hash()) {
+		this->storage = storage;
+		reset(root);
+	}
+
+	Hash getRoot() {
+		if (rootHash == Hash(0)) {
+			KeyValueStorage::WriteBatch batch;
+			if (hashPool) {
+				calculateHashParallel(batch);
+			}
+			rootHash = rootNode->calculateHash(storage, batch);
+			storage->write(batch);
+			if(rootHash == Hash(-1)){
+				rootHash = Hash(0);
+				return Hash(-1);
+			}
+		}
+		return rootHash;
+	}
+
+	void set(const KeyType &key, const ValueType &value) {
+		if (batching) {
+			Node* node = Node::insertInPlace(storage, key, 0, rootNode);
+			if (node && node->type == Type::LEAF) {
+				node->leaf()->value = value;
+				rootHash = Hash(0);
+			}
+			return;
+		}
+		std::shared_ptr<Node> newRoot;
+		Node* node = rootNode->insert(storage, key, 0, newRoot);
+		if (node && node->type == Type::LEAF) {
+			node->leaf()->value = value;
+			rootNode = newRoot;
+			rootHash = Hash(0);
+		}
+	}
+
+	//in a batch, nodes that are only owned by this tree are changed in place instead of being copied for every set
+	//nodes that are shared with other instances or copies of the tree are still copied, so they don't see the changes
+	void beginBatch() {
+		batching = true;
+	}
+
+	void setMany(const std::vector<std::pair<KeyType, ValueType>>& values) {
+		for (auto& i : values) {
+			set(i.first, i.second);
+		}
+	}
+
+	//hashes the changed nodes once and writes them in one batch
+	Hash commit() {
+		batching = false;
+		return getRoot();
+	}
+
+	bool has(const KeyType &key) {
+		Node* node = rootNode->getLeaf(storage, key);
+		if (node && node->type == Type::LEAF) {
+			return true;
+		}
+		return false;
+	}
+
+	ValueType get(const KeyType &key) {
+		Node *node = rootNode->getLeaf(storage, key);
+		if (node && node->type == Type::LEAF) {
+			return node->leaf()->value;
+		}
+		return ValueType();
+	}
+
+	bool reset(const Hash& root = Hash()) {
+		rootNode = Node::create(Type::NONE);
+		rootHash = Hash();
+		if (root != Hash()) {
+			std::shared_ptr<Node> node = Node::load(storage, root);
+			if (node->type != Type::NONE) {
+				rootNode = node;
+				rootHash = root;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//changed subtrees hashDepth levels below the root are hashed in parallel on the pool, the root is the same as when hashing on one thread
+	void setHashPool(ThreadPool* pool, int hashDepth = 6) {
+		this->hashPool = pool;
+		this->hashDepth = hashDepth;
+	}
+
+	Tree createInstance(const Hash& root) {
+		Tree instance;
+		instance.storage = storage;
+		instance.hashPool = hashPool;
+		instance.hashDepth = hashDepth;
+		//nodes are not shared with this tree, the decoded nodes come from the node cache instead
+		//so loaded subtrees are freed with the instance and trees on other threads don't load into the same nodes
+		instance.reset(root);
+		return instance;
+	}
+
+private:
+	KeyValueStorage* storage;
+	std::shared_ptr<Node> rootNode;
+	Hash rootHash;
+	bool batching = false;
+	ThreadPool* hashPool = nullptr;
+	int hashDepth = 0;
+
+	void calculateHashParallel(KeyValueStorage::WriteBatch& batch) {
+		std::vector<std::pair<Hash*, Node*>> childs;
+		rootNode->getDirtyChilds(hashDepth, childs);
+		std::vector<KeyValueStorage::WriteBatch> batches(childs.size());
+		std::vector<std::function<void()>> tasks;
+		for (int i = 0; i < (int)childs.size(); i++) {
+			tasks.push_back([&, i]() {
+				Hash hash = childs[i].second->calculateHash(storage, batches[i]);
+				//subtrees that can't be hashed are left changed, so the root fails like it would on one thread
+				*childs[i].first = hash == Hash(-1) ? Hash(0) : hash;
+			});
+		}
+		hashPool->run(tasks);
+		for (auto& i : batches) {
+			batch.append(i);
+		}
+	}
+};
@@ -0,0 +1,519 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include "BinaryTreeNode.h"
+#include <vector>
+
+template<typename KeyType, typename ValueType, bool useSerial, int radixBits>
+class RadixTreeBranch;
+template<typename KeyType, typename ValueType, bool useSerial, int radixBits>
+class RadixTreeExtension;
+template<typename KeyType, typename ValueType, bool useSerial, int radixBits>
+class RadixTreeLeaf;
+
+//node of a trie that consumes radixBits of the key per branch, it works like BinaryTreeNode otherwise
+//paths are counted in bits but always end on a digit, so extensions and leafs only split at digit boundaries
+template<typename KeyType, typename ValueType, bool useSerial, int radixBits>
+class RadixTreeNode {
+public:
+	typedef RadixTreeNode<KeyType, ValueType, useSerial, radixBits> Node;
+	typedef RadixTreeBranch<KeyType, ValueType, useSerial, radixBits> Branch;
+	typedef RadixTreeExtension<KeyType, ValueType, useSerial, radixBits> Extension;
+	typedef RadixTreeLeaf<KeyType, ValueType, useSerial, radixBits> Leaf;
+	typedef BinaryTreeKey<KeyType> Key;
+	typedef BinaryTreeNodeType Type;
+
+	static const int radix = 1 << radixBits;
+	static const int keyBits = sizeof(KeyType) * 8;
+	static_assert(radixBits >= 1 && radixBits <= 8 && keyBits % radixBits == 0, "the key has to consist of whole digits");
+
+	//a hash of 0 means the child was changed and has to be hashed again, the node is loaded when it is first needed
+	class Child {
+	public:
+		Hash hash = Hash(0);
+		std::shared_ptr<Node> node;
+	};
+
+	BinaryTreeNodeType type;
+	uint16_t pathLength;
+
+	RadixTreeNode() {
+		type = BinaryTreeNodeType::NONE;
+		pathLength = 0;
+	}
+
+	Branch* branch() {
+		return static_cast<Branch*>(this);
+	}
+
+	Extension* extension() {
+		return static_cast<Extension*>(this);
+	}
+
+	Leaf* leaf() {
+		return static_cast<Leaf*>(this);
+	}
+
+	static std::shared_ptr<Node> create(Type type) {
+		if (type == Type::BRANCH) {
+			return std::allocate_shared<Branch>(PoolAllocator<Branch>());
+		}
+		else if (type == Type::EXTENSION) {
+			return std::allocate_shared<Extension>(PoolAllocator<Extension>());
+		}
+		else if (type == Type::LEAF) {
+			return std::allocate_shared<Leaf>(PoolAllocator<Leaf>());
+		}
+		return std::allocate_shared<Node>(PoolAllocator<Node>());
+	}
+
+	static NodeCache<Node>& getCache() {
+		return NodeCache<Node>::getInstance();
+	}
+
+	//missing or unknown nodes result in an empty node
+	static std::shared_ptr<Node> load(KeyValueStorage* storage, const Hash& hash) {
+		std::shared_ptr<const Node> cached = getCache().get(hash);
+		if (cached) {
+			return cached->copy();
+		}
+		std::string data = storage->get(hash);
+		if (data.empty()) {
+			return create(Type::NONE);
+		}
+		std::shared_ptr<Node> node = create((Type)data[0]);
+		if (node->type != (Type)data[0]) {
+			return node;
+		}
+		node->deserial(data);
+		getCache().set(hash, node->copy(), node->getMemorySize());
+		return node;
+	}
+
+	std::shared_ptr<Node> copy() const {
+		if (type == Type::BRANCH) {
+			return std::allocate_shared<Branch>(PoolAllocator<Branch>(), static_cast<const Branch&>(*this));
+		}
+		else if (type == Type::EXTENSION) {
+			return std::allocate_shared<Extension>(PoolAllocator<Extension>(), static_cast<const Extension&>(*this));
+		}
+		else if (type == Type::LEAF) {
+			return std::allocate_shared<Leaf>(PoolAllocator<Leaf>(), static_cast<const Leaf&>(*this));
+		}
+		return std::allocate_shared<Node>(PoolAllocator<Node>(), *this);
+	}
+
+	//approximate, including the overhead of the shared pointer
+	uint64_t getMemorySize() const {
+		uint64_t size = sizeof(Node);
+		if (type == Type::BRANCH) {
+			size = sizeof(Branch) + static_cast<const Branch*>(this)->childs.capacity() * sizeof(Child);
+		}
+		else if (type == Type::EXTENSION) {
+			size = sizeof(Extension);
+		}
+		else if (type == Type::LEAF) {
+			size = sizeof(Leaf);
+		}
+		return size + 64;
+	}
+
+	//branches store a bitmap of their children followed by the hashes of the present ones
+	//paths only store the bytes that are covered by the path length
+	std::string serial() {
+		Serializer serial;
+		serial.write(type);
+		serial.write(pathLength);
+		if (type == BinaryTreeNodeType::BRANCH) {
+			serial.writeBytes((uint8_t*)branch()->bitmap, Branch::bitmapBytes);
+			for (auto& child : branch()->childs) {
+				serial.write(child.hash);
+			}
+		}
+		else if (type == BinaryTreeNodeType::EXTENSION) {
+			serial.writeBytes((uint8_t*)&extension()->path.key, (pathLength + 7) / 8);
+			serial.write(extension()->child.hash);
+		}
+		else if (type == BinaryTreeNodeType::LEAF) {
+			serial.writeBytes((uint8_t*)&leaf()->path.key, (pathLength + 7) / 8);
+			if constexpr (useSerial) {
+				std::string str = leaf()->value.serial();
+				serial.writeBytes((uint8_t*)str.data(), str.size());
+			}
+			else {
+				serial.write(leaf()->value);
+			}
+		}
+		return serial.toString();
+	}
+
+	//the node has to be created with the type that is stored in the data
+	int deserial(const std::string& str) {
+		Serializer serial(str);
+		serial.read(type);
+		serial.read(pathLength);
+		if (pathLength > keyBits) {
+			pathLength = 0;
+		}
+		if (type == BinaryTreeNodeType::BRANCH) {
+			serial.readBytes((uint8_t*)branch()->bitmap, Branch::bitmapBytes);
+			branch()->childs.resize(branch()->count());
+			for (auto& child : branch()->childs) {
+				serial.read(child.hash);
+			}
+		}
+		else if (type == BinaryTreeNodeType::EXTENSION) {
+			serial.readBytes((uint8_t*)&extension()->path.key, (pathLength + 7) / 8);
+			serial.read(extension()->child.hash);
+		}
+		else if (type == BinaryTreeNodeType::LEAF) {
+			serial.readBytes((uint8_t*)&leaf()->path.key, (pathLength + 7) / 8);
+			if constexpr (useSerial) {
+				leaf()->value.deserial(serial.readAll());
+			}
+			else {
+				serial.read(leaf()->value);
+			}
+		}
+		return serial.getReadIndex();
+	}
+
+	Hash calculateHash(KeyValueStorage* storage, KeyValueStorage::WriteBatch& batch) {
+		if (type == Type::NONE) {
+			return Hash(0);
+		}
+		else if (type == BinaryTreeNodeType::BRANCH) {
+			for (auto& child : branch()->childs) {
+				if (!calculateChildHash(storage, batch, child)) {
+					return Hash(-1);
+				}
+			}
+		}
+		else if (type == BinaryTreeNodeType::EXTENSION) {
+			if (!calculateChildHash(storage, batch, extension()->child)) {
+				return Hash(-1);
+			}
+		}
+		std::string data = serial();
+		Hash hash = sha256(data);
+		if (!storage->has(hash)) {
+			batch.set(hash, data);
+		}
+		return hash;
+	}
+
+	//collects the changed children depth levels below this node, so they can be hashed independently
+	void getDirtyChilds(int depth, std::vector<std::pair<Hash*, Node*>>& childs) {
+		if (type == Type::BRANCH) {
+			for (auto& child : branch()->childs) {
+				getDirtyChild(depth, child, childs);
+			}
+		}
+		else if (type == Type::EXTENSION) {
+			getDirtyChild(depth, extension()->child, childs);
+		}
+	}
+
+	Node* getLeaf(KeyValueStorage* storage, const Key& key) {
+		Node* node = this;
+		int bitOffset = 0;
+		while (node) {
+			if (node->type == Type::BRANCH) {
+				Child* child = node->branch()->find(key.getBits(bitOffset, radixBits));
+				if (!child) {
+					return nullptr;
+				}
+				node = getNode(storage, *child);
+				bitOffset += radixBits;
+			}
+			else if (node->type == Type::EXTENSION) {
+				if (node->extension()->path.bitMatch(key, bitOffset) < node->pathLength) {
+					return nullptr;
+				}
+				bitOffset += node->pathLength;
+				node = getNode(storage, node->extension()->child);
+			}
+			else if (node->type == Type::LEAF) {
+				if (node->leaf()->path.bitMatch(key, bitOffset) < node->pathLength) {
+					return nullptr;
+				}
+				return node;
+			}
+			else {
+				return nullptr;
+			}
+		}
+		return nullptr;
+	}
+
+	static std::shared_ptr<Node> createLeaf(const Key& key, int bitOffset) {
+		std::shared_ptr<Node> node = create(Type::LEAF);
+		node->pathLength = keyBits - bitOffset;
+		node->leaf()->path.copyBits(key, bitOffset, node->pathLength);
+		return node;
+	}
+
+	static std::shared_ptr<Node> createExtension(const Key& key, int bitOffset, int pathLength) {
+		std::shared_ptr<Node> node = create(Type::EXTENSION);
+		node->pathLength = pathLength;
+		node->extension()->path.copyBits(key, bitOffset, node->pathLength);
+		return node;
+	}
+
+	//copies the nodes on the path to the key into newRoot and returns the leaf for the key
+	Node* insert(KeyValueStorage* storage, const Key& key, int bitOffset, std::shared_ptr<Node>& newRoot) {
+		if (type == Type::NONE) {
+			newRoot = createLeaf(key, bitOffset);
+			return newRoot.get();
+		}
+		else if (type == Type::BRANCH) {
+			int digit = key.getBits(bitOffset, radixBits);
+			Child* child = branch()->find(digit);
+			if (!child) {
+				newRoot = copy();
+				Child& added = newRoot->branch()->add(digit);
+				added.node = createLeaf(key, bitOffset + radixBits);
+				return added.node.get();
+			}
+			Node* next = getNode(storage, *child);
+			if (!next) {
+				return nullptr;
+			}
+			std::shared_ptr<Node> newChild;
+			Node* leaf = next->insert(storage, key, bitOffset + radixBits, newChild);
+			if (leaf) {
+				newRoot = copy();
+				Child* copied = newRoot->branch()->find(digit);
+				copied->hash = Hash(0);
+				copied->node = newChild;
+			}
+			return leaf;
+		}
+		else if (type == Type::EXTENSION || type == Type::LEAF) {
+			Key& path = type == Type::LEAF ? leaf()->path : extension()->path;
+			int match = std::min<int>(path.bitMatch(key, bitOffset), pathLength) / radixBits * radixBits;
+			if (match < pathLength) {
+				return split(key, bitOffset, match, newRoot);
+			}
+			if (type == Type::LEAF) {
+				newRoot = copy();
+				return newRoot.get();
+			}
+			Node* next = getNode(storage, extension()->child);
+			if (!next) {
+				return nullptr;
+			}
+			std::shared_ptr<Node> newChild;
+			Node* leaf = next->insert(storage, key, bitOffset + pathLength, newChild);
+			if (leaf) {
+				newRoot = copy();
+				newRoot->extension()->child.hash = Hash(0);
+				newRoot->extension()->child.node = newChild;
+			}
+			return leaf;
+		}
+		return nullptr;
+	}
+
+	//like insert, but nodes that are only owned by their parent are changed in place, node is replaced by its copy otherwise
+	static Node* insertInPlace(KeyValueStorage* storage, const Key& key, int bitOffset, std::shared_ptr<Node>& node) {
+		if (node.use_count() == 1) {
+			if (node->type == Type::BRANCH) {
+				int digit = key.getBits(bitOffset, radixBits);
+				Child* child = node->branch()->find(digit);
+				if (!child) {
+					Child& added = node->branch()->add(digit);
+					added.node = createLeaf(key, bitOffset + radixBits);
+					return added.node.get();
+				}
+				if (!getNode(storage, *child)) {
+					return nullptr;
+				}
+				Node* leaf = insertInPlace(storage, key, bitOffset + radixBits, child->node);
+				if (leaf) {
+					child->hash = Hash(0);
+				}
+				return leaf;
+			}
+			else if (node->type == Type::LEAF) {
+				if (node->leaf()->path.bitMatch(key, bitOffset) >= node->pathLength) {
+					return node.get();
+				}
+			}
+			else if (node->type == Type::EXTENSION) {
+				Child& child = node->extension()->child;
+				if (node->extension()->path.bitMatch(key, bitOffset) >= node->pathLength) {
+					if (!getNode(storage, child)) {
+						return nullptr;
+					}
+					Node* leaf = insertInPlace(storage, key, bitOffset + node->pathLength, child.node);
+					if (leaf) {
+						child.hash = Hash(0);
+					}
+					return leaf;
+				}
+			}
+		}
+		std::shared_ptr<Node> newRoot;
+		Node* leaf = node->insert(storage, key, bitOffset, newRoot);
+		if (leaf) {
+			node = newRoot;
+		}
+		return leaf;
+	}
+
+private:
+	static void getDirtyChild(int depth, Child& child, std::vector<std::pair<Hash*, Node*>>& childs) {
+		if (child.hash == Hash(0) && child.node) {
+			if (depth <= 1) {
+				childs.push_back({ &child.hash, child.node.get() });
+			}
+			else {
+				child.node->getDirtyChilds(depth - 1, childs);
+			}
+		}
+	}
+
+	static Node* getNode(KeyValueStorage* storage, Child& child) {
+		if (!child.node) {
+			if (child.hash == Hash(0)) {
+				return nullptr;
+			}
+			child.node = load(storage, child.hash);
+		}
+		return child.node.get();
+	}
+
+	//-1 means a child could not be loaded
+	static bool calculateChildHash(KeyValueStorage* storage, KeyValueStorage::WriteBatch& batch, Child& child) {
+		if (child.hash == Hash(0)) {
+			if (!child.node) {
+				return false;
+			}
+			child.hash = child.node->calculateHash(storage, batch);
+			if (child.hash == Hash(-1)) {
+				child.hash = Hash(0);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//splits this leaf or extension at the first digit that differs from the key
+	//the old child of an extension is kept by its hash, so it doesn't have to be loaded
+	Node* split(const Key& key, int bitOffset, int match, std::shared_ptr<Node>& newRoot) {
+		Key& path = type == Type::LEAF ? leaf()->path : extension()->path;
+		int rest = pathLength - match - radixBits;
+
+		Child old;
+		if (type == Type::LEAF) {
+			old.node = create(Type::LEAF);
+			old.node->pathLength = rest;
+			old.node->leaf()->path.copyBits(path, match + radixBits, rest);
+			old.node->leaf()->value = leaf()->value;
+		}
+		else if (rest == 0) {
+			old = extension()->child;
+		}
+		else {
+			old.node = create(Type::EXTENSION);
+			old.node->pathLength = rest;
+			old.node->extension()->path.copyBits(path, match + radixBits, rest);
+			old.node->extension()->child = extension()->child;
+		}
+
+		std::shared_ptr<Node> newBranch = create(Type::BRANCH);
+		std::shared_ptr<Node> newLeaf = createLeaf(key, bitOffset + match + radixBits);
+		newBranch->branch()->add(path.getBits(match, radixBits)) = old;
+		newBranch->branch()->add(key.getBits(bitOffset + match, radixBits)).node = newLeaf;
+
+		if (match > 0) {
+			newRoot = createExtension(key, bitOffset, match);
+			newRoot->extension()->child.node = newBranch;
+		}
+		else {
+			newRoot = newBranch;
+		}
+		return newLeaf.get();
+	}
+};
+
+//the children are only stored for set bits of the bitmap, in the order of their digits
+template<typename KeyType, typename ValueType, bool useSerial, int radixBits>
+class RadixTreeBranch : public RadixTreeNode<KeyType, ValueType, useSerial, radixBits> {
+public:
+	typedef RadixTreeNode<KeyType, ValueType, useSerial, radixBits> Node;
+	typedef typename Node::Child Child;
+
+	static const int bitmapBytes = (Node::radix + 7) / 8;
+
+	uint64_t bitmap[(Node::radix + 63) / 64];
+	std::vector<Child> childs;
+
+	RadixTreeBranch() {
+		this->type = BinaryTreeNodeType::BRANCH;
+		memset(bitmap, 0, sizeof(bitmap));
+	}
+
+	int count() const {
+		int count = 0;
+		for (uint64_t word : bitmap) {
+			count += std::popcount(word);
+		}
+		return count;
+	}
+
+	Child* find(int digit) {
+		if (!(bitmap[digit / 64] & ((uint64_t)1 << (digit % 64)))) {
+			return nullptr;
+		}
+		return &childs[index(digit)];
+	}
+
+	//the reference is only valid until the next child is added
+	Child& add(int digit) {
+		bitmap[digit / 64] |= (uint64_t)1 << (digit % 64);
+		return *childs.emplace(childs.begin() + index(digit));
+	}
+
+private:
+	int index(int digit) const {
+		int index = 0;
+		for (int i = 0; i < digit / 64; i++) {
+			index += std::popcount(bitmap[i]);
+		}
+		return index + std::popcount(bitmap[digit / 64] & (((uint64_t)1 << (digit % 64)) - 1));
+	}
+};
+
+template<typename KeyType, typename ValueType, bool useSerial, int radixBits>
+class RadixTreeExtension : public RadixTreeNode<KeyType, ValueType, useSerial, radixBits> {
+public:
+	typedef RadixTreeNode<KeyType, ValueType, useSerial, radixBits> Node;
+	typedef BinaryTreeKey<KeyType> Key;
+
+	Key path;
+	typename Node::Child child;
+
+	RadixTreeExtension() {
+		this->type = BinaryTreeNodeType::EXTENSION;
+	}
+};
+
+template<typename KeyType, typename ValueType, bool useSerial, int radixBits>
+class RadixTreeLeaf : public RadixTreeNode<KeyType, ValueType, useSerial, radixBits> {
+public:
+	typedef RadixTreeNode<KeyType, ValueType, useSerial, radixBits> Node;
+	typedef BinaryTreeKey<KeyType> Key;
+
+	Key path;
+	ValueType value;
+
+	RadixTreeLeaf() {
+		this->type = BinaryTreeNodeType::LEAF;
+		value = ValueType();
+	}
+};
@@ -0,0 +1,52 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#include "Checksum.h"
+#include <cstring>
+
+class ChecksumTable {
+public:
+	uint32_t table[8][256];
+
+	ChecksumTable() {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t value = i;
+			for (int j = 0; j < 8; j++) {
+				value = (value >> 1) ^ ((value & 1) ? 0x82F63B78 : 0);
+			}
+			table[0][i] = value;
+		}
+		for (uint32_t i = 0; i < 256; i++) {
+			for (int j = 1; j < 8; j++) {
+				table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+			}
+		}
+	}
+};
+
+uint32_t checksum(const char* data, uint64_t size, uint32_t previous) {
+	static const ChecksumTable tables;
+	auto& table = tables.table;
+	const uint8_t* bytes = (const uint8_t*)data;
+	uint32_t value = ~previous;
+
+	//8 bytes are processed at once with one table per byte position
+	while (size >= 8) {
+		uint32_t low;
+		uint32_t high;
+		memcpy(&low, bytes, sizeof(low));
+		memcpy(&high, bytes + 4, sizeof(high));
+		low ^= value;
+		value = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24] ^
+			table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^ table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+		bytes += 8;
+		size -= 8;
+	}
+	while (size > 0) {
+		value = (value >> 8) ^ table[0][(value ^ *bytes) & 0xff];
+		bytes++;
+		size--;
+	}
+	return ~value;
+}
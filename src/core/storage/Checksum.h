@@ -0,0 +1,10 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include <cstdint>
+
+//crc32c, a previous checksum can be passed to continue it over more data
+uint32_t checksum(const char* data, uint64_t size, uint32_t previous = 0);
@@ -0,0 +1,341 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#include "CompressedSegment.h"
+#include <cstring>
+
+//every sequence is [token][literal length][literals][offset][match length]
+//the token holds 4 bits of literal length and 4 bits of match length - 4, a value of 15 is continued in extra bytes
+//the last sequence only has literals
+static void appendLength(std::string& out, uint64_t length) {
+	while (length >= 255) {
+		out.push_back((char)255);
+		length -= 255;
+	}
+	out.push_back((char)length);
+}
+
+static void appendSequence(std::string& out, const char* literals, uint64_t literalLength, uint64_t offset, uint64_t matchLength) {
+	uint8_t token = (uint8_t)(std::min<uint64_t>(literalLength, 15) << 4);
+	if (matchLength > 0) {
+		token |= (uint8_t)std::min<uint64_t>(matchLength - 4, 15);
+	}
+	out.push_back((char)token);
+	if (literalLength >= 15) {
+		appendLength(out, literalLength - 15);
+	}
+	out.append(literals, literalLength);
+	if (matchLength > 0) {
+		out.push_back((char)(offset & 0xff));
+		out.push_back((char)(offset >> 8));
+		if (matchLength - 4 >= 15) {
+			appendLength(out, matchLength - 4 - 15);
+		}
+	}
+}
+
+void lzCompress(const char* data, uint64_t size, std::string& out) {
+	const int hashBits = 14;
+	const uint64_t maxOffset = 65535;
+	out.clear();
+	std::vector<uint32_t> table(1 << hashBits, 0);
+
+	uint64_t anchor = 0;
+	uint64_t position = 0;
+	uint64_t misses = 0;
+	while (position + 4 <= size) {
+		uint32_t sequence;
+		memcpy(&sequence, data + position, sizeof(sequence));
+		uint32_t hash = (sequence * 2654435761u) >> (32 - hashBits);
+		//positions are stored + 1, so zero means empty
+		uint64_t candidate = table[hash];
+		table[hash] = (uint32_t)(position + 1);
+		if (candidate == 0 || position - (candidate - 1) > maxOffset || memcmp(data + candidate - 1, data + position, sizeof(sequence)) != 0) {
+			//skip faster through data that doesn't compress
+			position += 1 + (misses++ >> 6);
+			continue;
+		}
+		candidate--;
+		misses = 0;
+
+		uint64_t length = sizeof(sequence);
+		while (position + length < size && data[candidate + length] == data[position + length]) {
+			length++;
+		}
+		appendSequence(out, data + anchor, position - anchor, position - candidate, length);
+		position += length;
+		anchor = position;
+	}
+	appendSequence(out, data + anchor, size - anchor, 0, 0);
+}
+
+bool lzDecompress(const char* data, uint64_t size, char* out, uint64_t outSize) {
+	const uint8_t* in = (const uint8_t*)data;
+	const uint8_t* end = in + size;
+	uint64_t position = 0;
+	while (in < end) {
+		uint8_t token = *in++;
+		uint64_t literalLength = token >> 4;
+		if (literalLength == 15) {
+			uint8_t value = 255;
+			while (value == 255) {
+				if (in >= end) {
+					return false;
+				}
+				value = *in++;
+				literalLength += value;
+			}
+		}
+		if (literalLength > (uint64_t)(end - in) || literalLength > outSize - position) {
+			return false;
+		}
+		memcpy(out + position, in, literalLength);
+		in += literalLength;
+		position += literalLength;
+		if (in == end) {
+			break;
+		}
+
+		if (end - in < 2) {
+			return false;
+		}
+		uint64_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		uint64_t matchLength = (token & 15) + 4;
+		if ((token & 15) == 15) {
+			uint8_t value = 255;
+			while (value == 255) {
+				if (in >= end) {
+					return false;
+				}
+				value = *in++;
+				matchLength += value;
+			}
+		}
+		if (offset == 0 || offset > position || matchLength > outSize - position) {
+			return false;
+		}
+		char* target = out + position;
+		const char* source = target - offset;
+		if (offset >= matchLength) {
+			memcpy(target, source, matchLength);
+		}
+		else {
+			//overlapping matches repeat the last offset bytes
+			for (uint64_t i = 0; i < matchLength; i++) {
+				target[i] = source[i];
+			}
+		}
+		position += matchLength;
+	}
+	return position == outSize;
+}
+
+BlockCache::BlockCache(uint64_t capacity) {
+	stats.capacity = capacity;
+}
+
+std::shared_ptr<const std::string> BlockCache::get(uint64_t key) {
+	std::unique_lock<std::mutex> lock(mutex);
+	auto i = entries.find(key);
+	if (i == entries.end()) {
+		stats.misses++;
+		return nullptr;
+	}
+	stats.hits++;
+	lru.splice(lru.begin(), lru, i->second);
+	return i->second->block;
+}
+
+void BlockCache::set(uint64_t key, const std::shared_ptr<const std::string>& block) {
+	std::unique_lock<std::mutex> lock(mutex);
+	auto i = entries.find(key);
+	if (i != entries.end()) {
+		stats.bytes -= i->second->block->size();
+		lru.erase(i->second);
+		entries.erase(i);
+	}
+	if (block->size() > stats.capacity) {
+		return;
+	}
+	lru.push_front({ key, block });
+	entries[key] = lru.begin();
+	stats.bytes += block->size();
+	setCapacity(stats.capacity);
+}
+
+void BlockCache::setCapacity(uint64_t capacity) {
+	stats.capacity = capacity;
+	while (stats.bytes > stats.capacity && !lru.empty()) {
+		stats.bytes -= lru.back().block->size();
+		entries.erase(lru.back().key);
+		lru.pop_back();
+		stats.evictions++;
+	}
+	stats.entries = entries.size();
+}
+
+StorageCacheStats BlockCache::getStats() {
+	std::unique_lock<std::mutex> lock(mutex);
+	return stats;
+}
+
+bool CompressedSegment::open(const std::shared_ptr<MappedFile>& map, uint64_t cacheId) {
+	this->map = map;
+	this->cacheId = cacheId;
+	if (!map->contains(0, sizeof(footer))) {
+		return false;
+	}
+	memcpy(&footer, map->data() + map->size() - sizeof(footer), sizeof(footer));
+	if (footer.magic != magic || footer.blockSize == 0) {
+		return false;
+	}
+	if (footer.blockCount != (footer.size + footer.blockSize - 1) / footer.blockSize) {
+		return false;
+	}
+	if (!map->contains(footer.tableOffset, footer.blockCount * sizeof(Block))) {
+		return false;
+	}
+	blocks.resize(footer.blockCount);
+	memcpy(blocks.data(), map->data() + footer.tableOffset, footer.blockCount * sizeof(Block));
+	for (auto& block : blocks) {
+		if (block.offset + block.size > footer.tableOffset) {
+			return false;
+		}
+	}
+	return true;
+}
+
+uint64_t CompressedSegment::size() const {
+	return footer.size;
+}
+
+const std::shared_ptr<MappedFile>& CompressedSegment::getMap() const {
+	return map;
+}
+
+bool CompressedSegment::read(uint64_t offset, uint64_t bytes, BlockCache& cache, std::string_view& data, std::shared_ptr<const std::string>& buffer) const {
+	if (offset + bytes > footer.size || offset + bytes < offset) {
+		return false;
+	}
+	if (bytes == 0) {
+		data = std::string_view();
+		return true;
+	}
+
+	uint64_t first = offset / footer.blockSize;
+	uint64_t last = (offset + bytes - 1) / footer.blockSize;
+	if (first == last) {
+		buffer = getBlock(first, cache);
+		if (!buffer) {
+			return false;
+		}
+		data = std::string_view(buffer->data() + offset % footer.blockSize, bytes);
+		return true;
+	}
+
+	//records that cross a block boundary are assembled into their own buffer
+	auto result = std::make_shared<std::string>();
+	result->reserve(bytes);
+	for (uint64_t i = first; i <= last; i++) {
+		auto block = getBlock(i, cache);
+		if (!block) {
+			return false;
+		}
+		uint64_t begin = i == first ? offset % footer.blockSize : 0;
+		uint64_t end = i == last ? (offset + bytes - 1) % footer.blockSize + 1 : block->size();
+		result->append(block->data() + begin, end - begin);
+	}
+	data = *result;
+	buffer = result;
+	return true;
+}
+
+std::shared_ptr<const std::string> CompressedSegment::getBlock(uint64_t index, BlockCache& cache) const {
+	uint64_t key = (cacheId << 32) | index;
+	auto cached = cache.get(key);
+	if (cached) {
+		return cached;
+	}
+
+	const Block& block = blocks[index];
+	uint64_t size = std::min<uint64_t>(footer.blockSize, footer.size - index * footer.blockSize);
+	auto data = std::make_shared<std::string>(size, '\0');
+	if (block.compressed) {
+		if (!lzDecompress(map->data() + block.offset, block.size, data->data(), size)) {
+			return nullptr;
+		}
+	}
+	else if (block.size == size) {
+		memcpy(data->data(), map->data() + block.offset, size);
+	}
+	else {
+		return nullptr;
+	}
+	cache.set(key, data);
+	return data;
+}
+
+bool SegmentWriter::open(const std::string& file, bool compressed) {
+	this->compressed = compressed;
+	pending.clear();
+	blocks.clear();
+	fileSize = 0;
+	size = 0;
+	stream.open(file, std::ios::binary | std::ios::trunc);
+	return stream.is_open();
+}
+
+void SegmentWriter::write(const char* data, uint64_t bytes) {
+	size += bytes;
+	if (!compressed) {
+		stream.write(data, bytes);
+		return;
+	}
+	pending.append(data, bytes);
+	if (pending.size() >= CompressedSegment::blockSize) {
+		uint64_t offset = 0;
+		while (pending.size() - offset >= CompressedSegment::blockSize) {
+			writeBlock(pending.data() + offset, CompressedSegment::blockSize);
+			offset += CompressedSegment::blockSize;
+		}
+		pending.erase(0, offset);
+	}
+}
+
+bool SegmentWriter::close() {
+	if (compressed) {
+		if (!pending.empty()) {
+			writeBlock(pending.data(), pending.size());
+			pending.clear();
+		}
+		CompressedSegment::Footer footer;
+		footer.tableOffset = fileSize;
+		footer.blockCount = blocks.size();
+		footer.size = size;
+		footer.blockSize = CompressedSegment::blockSize;
+		footer.magic = CompressedSegment::magic;
+		stream.write((char*)blocks.data(), blocks.size() * sizeof(CompressedSegment::Block));
+		stream.write((char*)&footer, sizeof(footer));
+	}
+	stream.close();
+	return (bool)stream;
+}
+
+void SegmentWriter::writeBlock(const char* data, uint64_t bytes) {
+	CompressedSegment::Block block;
+	block.offset = fileSize;
+	lzCompress(data, bytes, buffer);
+	if (buffer.size() < bytes) {
+		block.size = buffer.size();
+		block.compressed = 1;
+		stream.write(buffer.data(), buffer.size());
+	}
+	else {
+		block.size = bytes;
+		stream.write(data, bytes);
+	}
+	fileSize += block.size;
+	blocks.push_back(block);
+}
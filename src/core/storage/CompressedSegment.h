@@ -0,0 +1,102 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include "MappedFile.h"
+#include "StorageCache.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <fstream>
+
+//lz77 codec in the style of lz4, fast enough to decompress on every cache miss
+void lzCompress(const char* data, uint64_t size, std::string& out);
+bool lzDecompress(const char* data, uint64_t size, char* out, uint64_t outSize);
+
+//lru cache for decompressed segment blocks, the blocks are shared with the views that read from them
+class BlockCache {
+public:
+	BlockCache(uint64_t capacity = 32 * 1024 * 1024);
+
+	std::shared_ptr<const std::string> get(uint64_t key);
+	void set(uint64_t key, const std::shared_ptr<const std::string>& block);
+	void setCapacity(uint64_t capacity);
+	StorageCacheStats getStats();
+
+private:
+	class Entry {
+	public:
+		uint64_t key;
+		std::shared_ptr<const std::string> block;
+	};
+
+	std::mutex mutex;
+	std::list<Entry> lru;
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+	StorageCacheStats stats;
+};
+
+//read only access to a segment that was written in compressed blocks
+//records are still addressed by their offset in the uncompressed data, so index entries don't change when a segment is compressed
+class CompressedSegment {
+public:
+	static const uint32_t magic = 0x5A4C564B;
+	static const uint32_t blockSize = 16 * 1024;
+
+	class Block {
+	public:
+		uint64_t offset = 0;
+		uint32_t size = 0;
+		//blocks that don't get smaller are stored as they are
+		uint32_t compressed = 0;
+	};
+
+	class Footer {
+	public:
+		uint64_t tableOffset = 0;
+		uint64_t blockCount = 0;
+		uint64_t size = 0;
+		uint32_t blockSize = 0;
+		uint32_t magic = 0;
+	};
+
+	bool open(const std::shared_ptr<MappedFile>& map, uint64_t cacheId);
+	uint64_t size() const;
+	const std::shared_ptr<MappedFile>& getMap() const;
+
+	//returns the uncompressed range, the buffer keeps the data alive
+	bool read(uint64_t offset, uint64_t bytes, BlockCache& cache, std::string_view& data, std::shared_ptr<const std::string>& buffer) const;
+
+private:
+	std::shared_ptr<MappedFile> map;
+	std::vector<Block> blocks;
+	Footer footer;
+	uint64_t cacheId = 0;
+
+	std::shared_ptr<const std::string> getBlock(uint64_t index, BlockCache& cache) const;
+};
+
+//writes a segment either as it is or in compressed blocks
+class SegmentWriter {
+public:
+	bool open(const std::string& file, bool compressed);
+	void write(const char* data, uint64_t bytes);
+	bool close();
+
+private:
+	std::ofstream stream;
+	bool compressed = false;
+	std::string pending;
+	std::string buffer;
+	std::vector<CompressedSegment::Block> blocks;
+	uint64_t fileSize = 0;
+	uint64_t size = 0;
+
+	void writeBlock(const char* data, uint64_t bytes);
+};
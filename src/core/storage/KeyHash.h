@@ -0,0 +1,44 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+
+//hash for storage keys that reads 8 bytes at a time
+//it is transparent, so maps with std::string keys can be searched with a std::string_view without allocating
+//the value is stored in index checkpoints and must not change
+class KeyHash {
+public:
+	using is_transparent = void;
+
+	size_t operator()(std::string_view key) const {
+		return hash(key);
+	}
+
+	static uint64_t hash(std::string_view key) {
+		const char* data = key.data();
+		size_t size = key.size();
+		uint64_t value = 0x9E3779B97F4A7C15ull ^ size;
+		while (size >= sizeof(uint64_t)) {
+			uint64_t word;
+			memcpy(&word, data, sizeof(word));
+			value = (value ^ word) * 0xbf58476d1ce4e5b9ull;
+			value ^= value >> 31;
+			data += sizeof(word);
+			size -= sizeof(word);
+		}
+		if (size > 0) {
+			uint64_t word = 0;
+			memcpy(&word, data, size);
+			value = (value ^ word) * 0xbf58476d1ce4e5b9ull;
+			value ^= value >> 31;
+		}
+		value *= 0x94d049bb133111ebull;
+		value ^= value >> 29;
+		return value;
+	}
+};
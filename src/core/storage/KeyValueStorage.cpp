@@ -3,7 +3,19 @@
 //
 
 #include "KeyValueStorage.h"
+#include "Checksum.h"
+#include "util/log.h"
 #include <filesystem>
+#include <cstring>
+#include <algorithm>
+
+#if WIN32
+#include <Windows.h>
+#undef max
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 std::string readStr(std::ifstream& stream) {
 	int size = -1;
@@ -23,149 +35,1233 @@ T read(std::ifstream& stream) {
 	return t;
 }
 
-void writeStr(std::ofstream& stream, const std::string &str) {
+template<typename T>
+void write(std::ofstream& stream, const T &t) {
+	stream.write((char*)&t, sizeof(t));
+}
+
+void appendStr(std::string& buffer, const std::string& str) {
 	int size = str.size();
-	stream.write((char*)&size, sizeof(size));
-	stream.write(str.data(), str.size());
+	buffer.append((char*)&size, sizeof(size));
+	buffer.append(str);
 }
 
 template<typename T>
-void write(std::ofstream& stream, const T &t) {
-	stream.write((char*)&t, sizeof(t));
+void append(std::string& buffer, const T& t) {
+	buffer.append((char*)&t, sizeof(t));
+}
+
+void syncFile(const std::string& file) {
+#if WIN32
+	HANDLE handle = CreateFileA(file.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle != INVALID_HANDLE_VALUE) {
+		FlushFileBuffers(handle);
+		CloseHandle(handle);
+	}
+#else
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd != -1) {
+		fsync(fd);
+		close(fd);
+	}
+#endif
+}
+
+uint32_t recordChecksum(std::string_view value) {
+	//the size prefix is covered too, so a torn size can't point to a random range that happens to match
+	int size = value.size();
+	return checksum(value.data(), value.size(), checksum((char*)&size, sizeof(size)));
+}
+
+uint64_t checkpointHash(std::string_view key) {
+	//zero marks an empty checkpoint slot
+	uint64_t value = KeyHash::hash(key);
+	return value == 0 ? 1 : value;
+}
+
+void KeyValueStorage::WriteBatch::set(const std::string& key, const std::string& value) {
+	operations.push_back({ key, value, false });
+}
+
+void KeyValueStorage::WriteBatch::remove(const std::string& key) {
+	operations.push_back({ key, "", true });
+}
+
+void KeyValueStorage::WriteBatch::clear() {
+	operations.clear();
+}
+
+bool KeyValueStorage::WriteBatch::empty() const {
+	return operations.empty();
+}
+
+int KeyValueStorage::WriteBatch::size() const {
+	return operations.size();
+}
+
+void KeyValueStorage::WriteBatch::append(const WriteBatch& batch) {
+	operations.insert(operations.end(), batch.operations.begin(), batch.operations.end());
+}
+
+bool KeyValueStorage::View::empty() const {
+	return data.empty();
+}
+
+std::string KeyValueStorage::View::toString() const {
+	return std::string(data);
+}
+
+KeyValueStorage::~KeyValueStorage() {
+	stopCompactionThread();
+	stopSyncThread();
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	if (writeStream.is_open()) {
+		//a clean shutdown records the whole active segment as durable, so the next start doesn't have to check it
+		syncFiles();
+		saveManifest();
+	}
 }
 
 bool KeyValueStorage::init(const std::string& directory, int keySize, int valueSize) {
-	std::unique_lock<std::mutex> lock(mutex);
+	std::unique_lock<std::shared_mutex> lock(mutex);
 	this->directory = directory;
-	maxFileSize = 1024 * 1024 * 1024;
 	std::filesystem::create_directories(directory);
 	index.file = directory + "/index.dat";
+	index.checkpointFile = directory + "/index.chk";
+	manifestFile = directory + "/segments.dat";
 	index.header.keySize = keySize;
 	index.header.valueSize = valueSize;
 	if (!index.load()) {
 		return false;
 	}
 
-	for (int i = 0; i < 100; i++) {
-		std::string file = directory + "/data" + std::to_string(i) + ".dat";
-		if (std::filesystem::exists(file)) {
-			auto stream = std::make_shared<std::ifstream>();
-			stream->open(file, std::ios::binary);
-			streams.push_back(stream);
+	if (std::filesystem::exists(manifestFile)) {
+		if (!loadManifest()) {
+			return false;
 		}
-		else {
+	}
+	else {
+		//stores without a manifest have all segments next to the index, only the last one is still written
+		std::vector<int> ids = findSegments();
+		for (int i = 0; i < (int)ids.size(); i++) {
+			addSegment(ids[i], segmentFile(ids[i], false), i + 1 < (int)ids.size());
+			segments[ids[i]].format = 1;
+		}
+	}
+
+	nextSegmentId = segments.size();
+	writeStreamId = -1;
+	for (int i = nextSegmentId - 1; i >= 0; i--) {
+		if (segments[i].map && !segments[i].sealed) {
+			writeStreamId = i;
 			break;
 		}
 	}
-	
-	if (streams.size() == 0) {
-		std::string file = directory + "/data0.dat";
-		writeStream.open(file, std::ios::binary | std::ios::app);
+	if (writeStreamId == -1) {
+		writeStreamId = nextSegmentId++;
+		std::string file = segmentFile(writeStreamId, false);
+		writeStream.open(file, std::ios::binary | std::ios::trunc);
 		writeStream.close();
-
-		auto stream = std::make_shared<std::ifstream>();
-		stream->open(file, std::ios::binary);
-		streams.push_back(stream);
+		addSegment(writeStreamId, file, false);
+	}
+	recoveryStats = StorageRecoveryStats();
+	recoveryStats.indexBytesDropped = index.droppedBytes;
+	recoverSegment(writeStreamId);
+	if (!saveManifest()) {
+		return false;
 	}
 
-	writeStreamId = streams.size() - 1;
-	std::string file = directory + "/data" + std::to_string(writeStreamId) + ".dat";
-	writeStream.open(file, std::ios::binary | std::ios::app);
+	writeStream.open(segments[writeStreamId].file, std::ios::binary | std::ios::app);
 	writeStream.seekp(0, std::ios::end);
+	if (segments[writeStreamId].format != Segment().format) {
+		//records without checksums are not appended to, the old segment is sealed as it is
+		nextSegment();
+	}
+	if (index.legacy || index.header.version != Index::Header().version) {
+		return migrateIndex();
+	}
 	return true;
 }
 
-bool KeyValueStorage::has(const std::string& key) {
-	std::unique_lock<std::mutex> lock(mutex);
-	if (cache.find(key) != cache.end()) {
-		return true;
-	}
+bool KeyValueStorage::has(std::string_view key) {
+	std::shared_lock<std::shared_mutex> lock(mutex);
 	return index.has(key);
 }
 
-std::string KeyValueStorage::get(const std::string& key) {
-	std::unique_lock<std::mutex> lock(mutex);
-	auto i = cache.find(key);
-	if (i != cache.end()) {
-		return i->second;
+std::string KeyValueStorage::get(std::string_view key) {
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	std::string value;
+	if (cache->get(key, value)) {
+		return value;
 	}
 
-	if (streams.size() == 0) {
-		for (int i = 0; i < 100; i++) {
-			std::string file = directory + "/data" + std::to_string(i) + ".dat";
-			if (std::filesystem::exists(file)) {
-				auto stream = std::make_shared<std::ifstream>();
-				stream->open(file, std::ios::binary);
-				streams.push_back(stream);
-			}
-			else {
-				break;
+	Index::Entry entry = index.get(key);
+	View view = readView(entry, lock);
+	value = view.toString();
+
+	//readView might release the lock to remap a segment, only cache the value if it was not replaced in the meantime
+	Index::Entry current = index.get(key);
+	if (current.fileId != -1 && current.fileId == entry.fileId && current.offset == entry.offset) {
+		cache->set(key, value);
+	}
+	return value;
+}
+
+KeyValueStorage::View KeyValueStorage::getView(std::string_view key) {
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	return readView(index.get(key), lock);
+}
+
+std::vector<std::string> KeyValueStorage::getMany(const std::vector<std::string_view>& keys) {
+	class Read {
+	public:
+		int index;
+		Index::Entry entry;
+	};
+
+	std::vector<std::string> values(keys.size());
+	std::vector<Read> reads;
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	for (int i = 0; i < (int)keys.size(); i++) {
+		if (!cache->get(keys[i], values[i])) {
+			Index::Entry entry = index.get(keys[i]);
+			if (entry.fileId != -1) {
+				reads.push_back({ i, entry });
 			}
 		}
 	}
+	std::sort(reads.begin(), reads.end(), [](const Read& a, const Read& b) {
+		if (a.entry.fileId != b.entry.fileId) {
+			return a.entry.fileId < b.entry.fileId;
+		}
+		return a.entry.offset < b.entry.offset;
+	});
 
-	Index::Entry entry = index.get(key);
-	if (streams.size() > entry.fileId) {
-		auto &stream = *streams[entry.fileId].get();
-		stream.seekg(entry.offset);
-		std::string value = readStr(stream);
-		cache[key] = value;
-		return value;
+	//records that are close together are prefetched as one range, so the os can read them with few large requests
+	//offsets are signed and sorted within a file, so the gap between neighbours is never negative
+	const int64_t maxGap = 64 * 1024;
+	for (int begin = 0; begin < (int)reads.size();) {
+		int end = begin + 1;
+		while (end < (int)reads.size() && reads[end].entry.fileId == reads[begin].entry.fileId && reads[end].entry.offset - reads[end - 1].entry.offset < maxGap) {
+			end++;
+		}
+		Segment& segment = segments[reads[begin].entry.fileId];
+		if (segment.map && !segment.compressed) {
+			uint64_t offset = reads[begin].entry.offset;
+			uint64_t last = reads[end - 1].entry.offset;
+			uint64_t size = segment.size > last ? std::min<uint64_t>(segment.size - last, maxGap) : 0;
+			segment.map->prefetch(offset, last + size - offset);
+		}
+		begin = end;
 	}
-	else {
-		return "";
+
+	for (auto& read : reads) {
+		View view = readView(read.entry, lock);
+		values[read.index] = view.toString();
+
+		//readView might release the lock to remap a segment, only cache the value if it was not replaced in the meantime
+		Index::Entry current = index.get(keys[read.index]);
+		if (current.fileId == read.entry.fileId && current.offset == read.entry.offset) {
+			cache->set(keys[read.index], values[read.index]);
+		}
 	}
+	return values;
 }
 
 void KeyValueStorage::set(const std::string& key, const std::string& value) {
-	std::unique_lock<std::mutex> lock(mutex);
-	Index::Entry entry;
-	entry.offset = writeStream.tellp();
-	while (entry.offset == -1) {
+	WriteBatch batch;
+	batch.set(key, value);
+	write(batch);
+}
+
+void KeyValueStorage::remove(const std::string& key) {
+	WriteBatch batch;
+	batch.remove(key);
+	write(batch);
+}
+
+void KeyValueStorage::write(const WriteBatch& batch) {
+	if (batch.empty()) {
+		return;
+	}
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	int64_t offset = writeStream.tellp();
+	while (offset == -1) {
 		writeStream.close();
-		std::string file = directory + "/data" + std::to_string(writeStreamId) + ".dat";
-		writeStream.open(file, std::ios::binary | std::ios::app);
+		writeStream.open(segments[writeStreamId].file, std::ios::binary | std::ios::app);
 		writeStream.seekp(0, std::ios::end);
-		entry.offset = writeStream.tellp();
+		offset = writeStream.tellp();
 	}
 
-	if (entry.offset + 4 + value.size() > maxFileSize) {
-		writeStream.close();
-		writeStreamId++;
-		std::string file = directory + "/data" + std::to_string(writeStreamId) + ".dat";
-
-		writeStream.open(file, std::ios::binary | std::ios::app);
-		writeStream.close();
+	std::string buffer;
+	for (auto& operation : batch.operations) {
+		if (operation.remove) {
+			cache->remove(operation.key);
+			index.remove(operation.key);
+			continue;
+		}
 
-		auto stream = std::make_shared<std::ifstream>();
-		stream->open(file, std::ios::binary);
-		streams.push_back(stream);
+		uint64_t size = sizeof(int) + sizeof(uint32_t) + operation.value.size();
+		if (offset + size > maxSegmentSize && offset > 0) {
+			writeStream.write(buffer.data(), buffer.size());
+			writeStream.flush();
+			segments[writeStreamId].size = offset;
+			buffer.clear();
+			nextSegment();
+			offset = 0;
+		}
 
-		writeStream.open(file, std::ios::binary | std::ios::app);
-		writeStream.seekp(0, std::ios::end);
-		entry.offset = writeStream.tellp();
+		Index::Entry entry;
+		entry.fileId = writeStreamId;
+		entry.size = operation.value.size();
+		entry.offset = offset;
+		append(buffer, (int)operation.value.size());
+		append(buffer, recordChecksum(operation.value));
+		buffer.append(operation.value);
+		offset += size;
+		index.set(operation.key, entry);
+		cache->set(operation.key, operation.value);
 	}
 
-	entry.fileId = writeStreamId;
-	writeStr(writeStream, value);
+	//the data has to reach the file before the index entries that point to it
+	writeStream.write(buffer.data(), buffer.size());
 	writeStream.flush();
-	index.set(key, entry);
-	cache[key] = value;
+	segments[writeStreamId].size = offset;
+	index.flush();
+
+	if (durability == StorageDurability::BATCH) {
+		syncFiles();
+	}
+	else if (durability == StorageDurability::PERIODIC) {
+		unsynced = true;
+	}
 }
 
-void KeyValueStorage::remove(const std::string& key) {
-	std::unique_lock<std::mutex> lock(mutex);
-	cache.erase(key);
-	index.remove(key);
+void KeyValueStorage::setDurability(StorageDurability durability, int syncIntervalMilliseconds) {
+	stopSyncThread();
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	this->durability = durability;
+	this->syncInterval = syncIntervalMilliseconds;
+	if (durability == StorageDurability::PERIODIC) {
+		syncRunning = true;
+		syncThread = new std::thread([&]() {
+			std::unique_lock<std::shared_mutex> lock(mutex);
+			while (syncRunning) {
+				syncCondition.wait_for(lock, std::chrono::milliseconds(syncInterval));
+				if (unsynced) {
+					//sync without holding the lock, so readers and writers are not blocked by the disk
+					unsynced = false;
+					int dataId = writeStreamId;
+					uint64_t dataSize = segments[writeStreamId].size;
+					std::string dataFile = segments[writeStreamId].file;
+					std::string indexFile = index.file;
+					lock.unlock();
+					syncFile(dataFile);
+					syncFile(indexFile);
+					lock.lock();
+					if (segments[dataId].map && segments[dataId].file == dataFile) {
+						segments[dataId].durableSize = std::max(segments[dataId].durableSize, dataSize);
+					}
+				}
+			}
+		});
+	}
+}
+
+void KeyValueStorage::sync() {
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	syncFiles();
+}
+
+StorageRecoveryStats KeyValueStorage::getRecoveryStats() {
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	return recoveryStats;
+}
+
+void KeyValueStorage::setCache(const std::shared_ptr<StorageCache>& cache) {
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	this->cache = cache;
+}
+
+void KeyValueStorage::setCacheSize(uint64_t bytes) {
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	cache->setCapacity(bytes);
+}
+
+StorageCacheStats KeyValueStorage::getCacheStats() {
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	return cache->getStats();
+}
+
+void KeyValueStorage::compact(float minGarbageRatio) {
+	compactSegments(minGarbageRatio);
+
+	//keep the log that has to be replayed at startup short
+	bool needsCheckpoint = false;
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		needsCheckpoint = index.entries.size() > std::max<uint64_t>(4096, index.count / 64);
+	}
+	if (needsCheckpoint) {
+		checkpoint();
+	}
+	relocateSegments();
+}
+
+void KeyValueStorage::compactSegments(float minGarbageRatio) {
+	class CompactionRecord {
+	public:
+		std::string key;
+		Index::Entry entry;
+	};
+
+	std::unique_lock<std::mutex> compactionLock(compactionMutex);
+
+	//records are copied from the mappings, so they have to cover the whole segment
+	std::vector<std::pair<int, uint64_t>> unmapped;
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		for (int i = 0; i < (int)segments.size(); i++) {
+			Segment& segment = segments[i];
+			if (segment.map && !segment.compressed && segment.size > 0 && !segment.map->contains(0, segment.size)) {
+				unmapped.push_back({ i, segment.size });
+			}
+		}
+	}
+	for (auto& i : unmapped) {
+		remap(i.first, i.second);
+	}
+
+	//find segments where enough bytes are no longer referenced by the index
+	std::vector<int> candidates;
+	bool rollActive = false;
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		std::vector<uint64_t> liveBytes(segments.size(), 0);
+		index.forEach([&](std::string_view, const Index::Entry& entry) {
+			if (entry.fileId >= 0 && entry.fileId < (int)segments.size()) {
+				liveBytes[entry.fileId] += recordSize(segments[entry.fileId], entry);
+			}
+		});
+		for (int i = 0; i < (int)segments.size(); i++) {
+			Segment& segment = segments[i];
+			if (!segment.map) {
+				continue;
+			}
+			uint64_t garbage = segment.size - std::min(segment.size, liveBytes[i]);
+			if (i == writeStreamId) {
+				if (segment.size > 0 && garbage > 0 && garbage >= segment.size * minGarbageRatio) {
+					rollActive = true;
+					candidates.push_back(i);
+				}
+			}
+			else if (liveBytes[i] == 0 || (garbage > 0 && garbage >= segment.size * minGarbageRatio)) {
+				candidates.push_back(i);
+			}
+		}
+	}
+	if (candidates.empty()) {
+		return;
+	}
+
+	if (rollActive) {
+		//seal the active segment, so no new records are written into it while it is compacted
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		if (std::find(candidates.begin(), candidates.end(), writeStreamId) != candidates.end()) {
+			nextSegment();
+		}
+	}
+
+	//all candidates are sealed now, so the live records can only move out of them but no new ones can appear
+	std::vector<CompactionRecord> records;
+	std::vector<Segment> sources;
+	bool compressOutputs = false;
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		sources.resize(segments.size());
+		compressOutputs = compression;
+		std::vector<bool> isCandidate(segments.size(), false);
+		for (int id : candidates) {
+			isCandidate[id] = true;
+			sources[id] = segments[id];
+		}
+		index.forEach([&](std::string_view key, const Index::Entry& entry) {
+			if (entry.fileId >= 0 && entry.fileId < (int)isCandidate.size() && isCandidate[entry.fileId]) {
+				records.push_back({ std::string(key), entry });
+			}
+		});
+	}
+	std::sort(records.begin(), records.end(), [](const CompactionRecord& a, const CompactionRecord& b) {
+		if (a.entry.fileId != b.entry.fileId) {
+			return a.entry.fileId < b.entry.fileId;
+		}
+		return a.entry.offset < b.entry.offset;
+	});
+
+	//copy the live records without holding the lock, limited to compactionRate bytes per second
+	std::vector<int> outputs;
+	std::vector<std::string> outputFiles;
+	std::vector<Index::Entry> moved(records.size());
+	std::vector<int> unreadable;
+	SegmentWriter out;
+	bool failed = false;
+	uint64_t outSize = 0;
+	uint64_t copied = 0;
+	uint64_t throttled = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < (int)records.size(); i++) {
+		CompactionRecord& record = records[i];
+		Segment& source = sources[record.entry.fileId];
+		std::string_view data;
+		std::shared_ptr<const std::string> buffer;
+		bool readable = readRecord(source, record.entry, data, buffer);
+		//records are always written in the current format, the checksum of older records is computed while copying
+		uint32_t crc = 0;
+		if (readable) {
+			std::string_view value = data.substr(recordHeaderSize(source));
+			crc = recordChecksum(value);
+			readable = source.format < 2 || memcmp(data.data() + sizeof(int), &crc, sizeof(crc)) == 0;
+			data = value;
+		}
+		if (!readable) {
+			//keep segments with records that can not be read, instead of dropping the records
+			moved[i].fileId = -1;
+			unreadable.push_back(record.entry.fileId);
+			continue;
+		}
+		int size = data.size();
+		uint64_t bytes = sizeof(size) + sizeof(crc) + data.size();
+
+		if (outputs.empty() || (outSize + bytes > maxSegmentSize && outSize > 0)) {
+			if (!outputs.empty()) {
+				failed |= !out.close();
+			}
+			std::unique_lock<std::shared_mutex> lock(mutex);
+			outputs.push_back(nextSegmentId++);
+			outputFiles.push_back(segmentFile(outputs.back(), true, compressOutputs));
+			failed |= !out.open(outputFiles.back(), compressOutputs);
+			outSize = 0;
+		}
+		out.write((char*)&size, sizeof(size));
+		out.write((char*)&crc, sizeof(crc));
+		out.write(data.data(), data.size());
+		moved[i] = record.entry;
+		moved[i].fileId = outputs.back();
+		moved[i].offset = outSize;
+		outSize += bytes;
+		copied += bytes;
+
+		if (copied - throttled >= 64 * 1024) {
+			throttled = copied;
+			throttle(copied, start);
+		}
+		if (compactionAbort) {
+			break;
+		}
+	}
+	if (!outputs.empty()) {
+		failed |= !out.close();
+	}
+
+	if (compactionAbort || failed) {
+		//the index does not reference the outputs yet, so they can simply be deleted
+		for (auto& file : outputFiles) {
+			std::error_code error;
+			std::filesystem::remove(file, error);
+		}
+		return;
+	}
+	for (auto& file : outputFiles) {
+		syncFile(file);
+	}
+
+	//the outputs have to be in the manifest before the index references them
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	for (int i = 0; i < (int)outputs.size(); i++) {
+		addSegment(outputs[i], outputFiles[i], true, compressOutputs);
+	}
+	if (!outputs.empty() && !saveManifest()) {
+		log(LogLevel::WARNING, "Storage", "failed to write segment manifest %s", manifestFile.c_str());
+		for (int i = 0; i < (int)outputs.size(); i++) {
+			segments[outputs[i]] = Segment();
+			std::error_code error;
+			std::filesystem::remove(outputFiles[i], error);
+		}
+		return;
+	}
+	for (int i = 0; i < (int)records.size(); i++) {
+		CompactionRecord& record = records[i];
+		Index::Entry current = index.get(record.key);
+		//records that were overwritten or removed while copying keep their new entry
+		if (moved[i].fileId != -1 && current.fileId == record.entry.fileId && current.offset == record.entry.offset) {
+			index.set(record.key, moved[i]);
+		}
+	}
+	index.flush();
+
+	//the moved entries have to be on disk before the old segments are deleted
+	std::string indexFile = index.file;
+	lock.unlock();
+	syncFile(indexFile);
+	lock.lock();
+
+	uint64_t reclaimed = 0;
+	if (!unreadable.empty()) {
+		log(LogLevel::WARNING, "Storage", "%i records in %s could not be read and stay in their segments", (int)unreadable.size(), directory.c_str());
+	}
+	for (int id : unreadable) {
+		candidates.erase(std::remove(candidates.begin(), candidates.end(), id), candidates.end());
+	}
+	for (int id : candidates) {
+		reclaimed += segments[id].size;
+		//readers might still hold views into the segment, the mapping stays valid until they are released
+		std::error_code error;
+		std::filesystem::remove(segments[id].file, error);
+		segments[id] = Segment();
+	}
+	//a segment that is listed but missing is skipped at startup, so the manifest is updated after deleting the files
+	saveManifest();
+	reclaimed -= std::min(reclaimed, copied);
+	if (!candidates.empty()) {
+		log(LogLevel::INFO, "Storage", "compacted %i segments in %s, %llu bytes reclaimed", (int)candidates.size(), directory.c_str(), (unsigned long long)reclaimed);
+	}
+}
+
+void KeyValueStorage::relocateSegments() {
+	class Move {
+	public:
+		int fileId;
+		std::string file;
+		Segment source;
+		bool compress;
+	};
+
+	std::unique_lock<std::mutex> compactionLock(compactionMutex);
+	std::vector<Move> moves;
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		if (sealedDirectory.empty() && !compression) {
+			return;
+		}
+		for (int i = 0; i < (int)segments.size(); i++) {
+			Segment& segment = segments[i];
+			if (!segment.map || !segment.sealed) {
+				continue;
+			}
+			//compressed segments stay compressed when they are moved, even if compression was disabled since
+			bool compressed = compression || segment.compressed;
+			std::string file = segmentFile(i, true, compressed);
+			if (std::filesystem::path(file) != std::filesystem::path(segment.file)) {
+				moves.push_back({ i, file, segment, compressed && !segment.compressed });
+			}
+		}
+	}
+
+	//sealed segments are immutable, so they are copied without the lock and only the mapping is swapped at the end
+	uint64_t copied = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (auto& move : moves) {
+		//compressed segments are copied as they are
+		std::shared_ptr<MappedFile>& map = move.source.map;
+		uint64_t size = move.source.compressed ? map->size() : move.source.size;
+		if (size > 0 && !map->contains(0, size)) {
+			continue;
+		}
+		SegmentWriter out;
+		bool failed = !out.open(move.file, move.compress);
+		const uint64_t chunkSize = 1024 * 1024;
+		for (uint64_t offset = 0; offset < size && !compactionAbort && !failed; offset += chunkSize) {
+			uint64_t bytes = std::min(chunkSize, size - offset);
+			out.write(map->data() + offset, bytes);
+			copied += bytes;
+			throttle(copied, start);
+		}
+		failed |= !out.close();
+		std::error_code error;
+		if (failed || compactionAbort) {
+			std::filesystem::remove(move.file, error);
+			return;
+		}
+		syncFile(move.file);
+
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		std::string previous = segments[move.fileId].file;
+		bool previousCompressed = (bool)segments[move.fileId].compressed;
+		addSegment(move.fileId, move.file, true, move.compress || previousCompressed);
+		if (!saveManifest()) {
+			log(LogLevel::WARNING, "Storage", "failed to write segment manifest %s", manifestFile.c_str());
+			addSegment(move.fileId, previous, true, previousCompressed);
+			std::filesystem::remove(move.file, error);
+			return;
+		}
+		lock.unlock();
+		std::filesystem::remove(previous, error);
+		if (move.compress) {
+			log(LogLevel::INFO, "Storage", "compressed segment %s to %s, %llu of %llu bytes", previous.c_str(), move.file.c_str(),
+				(unsigned long long)std::filesystem::file_size(move.file, error), (unsigned long long)size);
+		}
+		else {
+			log(LogLevel::INFO, "Storage", "moved segment %s to %s", previous.c_str(), move.file.c_str());
+		}
+	}
+}
+
+void KeyValueStorage::throttle(uint64_t bytes, std::chrono::steady_clock::time_point start) {
+	if (compactionRate == 0) {
+		return;
+	}
+	auto expected = std::chrono::microseconds(bytes * 1000000 / compactionRate);
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+	if (expected > elapsed) {
+		std::this_thread::sleep_for(expected - elapsed);
+	}
+}
+
+void KeyValueStorage::setCompaction(int intervalSeconds, uint64_t bytesPerSecond) {
+	stopCompactionThread();
+	compactionRate = bytesPerSecond;
+	if (intervalSeconds > 0) {
+		compactionRunning = true;
+		compactionThread = new std::thread([this, intervalSeconds]() {
+			std::unique_lock<std::mutex> lock(compactionWaitMutex);
+			while (compactionRunning) {
+				compactionCondition.wait_for(lock, std::chrono::seconds(intervalSeconds));
+				if (compactionRunning) {
+					lock.unlock();
+					compact();
+					lock.lock();
+				}
+			}
+		});
+	}
+}
+
+void KeyValueStorage::checkpoint() {
+	std::unique_lock<std::mutex> checkpointLock(checkpointMutex);
+	std::shared_ptr<Index::Checkpoint> base;
+	uint64_t logSize = 0;
+	int dataId = 0;
+	uint64_t dataSize = 0;
+	std::string dataFile;
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		if (index.entries.empty()) {
+			return;
+		}
+		//new changes go into a fresh map while the frozen ones are merged with the current checkpoint
+		index.frozen = std::move(index.entries);
+		index.entries.clear();
+		base = index.checkpoint;
+		std::error_code error;
+		logSize = std::filesystem::file_size(index.file, error);
+		dataId = writeStreamId;
+		dataSize = segments[writeStreamId].size;
+		dataFile = segments[writeStreamId].file;
+	}
+	//the checkpoint must not reference records that are not on disk yet
+	syncFile(dataFile);
+
+	//the frozen map is not modified while it exists, so it can be read without the lock
+	std::vector<std::pair<std::string_view, Index::Entry>> merged;
+	merged.reserve(index.frozen.size() + (base ? base->header.count : 0));
+	for (auto& i : index.frozen) {
+		if (i.second.fileId != -1) {
+			merged.push_back({ i.first, i.second });
+		}
+	}
+	if (base) {
+		base->forEach([&](std::string_view key, const Index::Entry& entry) {
+			if (index.frozen.find(key) == index.frozen.end()) {
+				merged.push_back({ key, entry });
+			}
+		});
+	}
+	std::string checkpointTmp = index.checkpointFile + ".tmp";
+	bool success = Index::Checkpoint::write(checkpointTmp, merged);
+	merged.clear();
+
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	std::string logTmp = index.file + ".tmp";
+	if (success) {
+		//the new log only contains the records written since the frozen map was taken
+		std::string buffer;
+		append(buffer, index.header);
+		std::ifstream in(index.file, std::ios::binary);
+		in.seekg(logSize);
+		buffer.append(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		in.close();
+		std::ofstream out(logTmp, std::ios::binary | std::ios::trunc);
+		out.write(buffer.data(), buffer.size());
+		out.close();
+		success = (bool)out;
+		syncFile(logTmp);
+	}
+
+	//the checkpoint is replaced first, replaying the complete old log on top of it still results in the same index
+	std::error_code error;
+	if (success) {
+		base = nullptr;
+		index.checkpoint = nullptr;
+		std::filesystem::rename(checkpointTmp, index.checkpointFile, error);
+		success = !error;
+	}
+	if (success) {
+		index.stream.close();
+		std::filesystem::rename(logTmp, index.file, error);
+		index.stream.open(index.file, std::ios::binary | std::ios::app);
+	}
+
+	auto table = std::make_shared<Index::Checkpoint>();
+	if (std::filesystem::exists(index.checkpointFile) && table->open(index.checkpointFile)) {
+		index.checkpoint = table;
+	}
+	else {
+		index.checkpoint = base;
+	}
+	if (!success) {
+		log(LogLevel::WARNING, "Storage", "failed to write index checkpoint %s", index.checkpointFile.c_str());
+		for (auto& i : index.frozen) {
+			index.entries.insert(i);
+		}
+	}
+	index.frozen.clear();
+
+	//move the recovery point forward, so a crash only has to check the records written after the checkpoint
+	if (success && segments[dataId].map && segments[dataId].file == dataFile) {
+		segments[dataId].durableSize = std::max(segments[dataId].durableSize, dataSize);
+		saveManifest();
+	}
+}
+
+void KeyValueStorage::setMaxSegmentSize(uint64_t bytes) {
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	maxSegmentSize = bytes;
+}
+
+void KeyValueStorage::setSealedDirectory(const std::string& directory) {
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	std::filesystem::create_directories(directory);
+	sealedDirectory = directory;
+}
+
+void KeyValueStorage::setCompression(bool enabled, uint64_t blockCacheSize) {
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	compression = enabled;
+	blockCache.setCapacity(blockCacheSize);
+}
+
+StorageCacheStats KeyValueStorage::getBlockCacheStats() {
+	return blockCache.getStats();
+}
+
+std::string KeyValueStorage::segmentFile(int fileId, bool sealed, bool compressed) {
+	std::string name = "/data" + std::to_string(fileId) + (compressed ? ".lz" : ".dat");
+	if (sealed && !sealedDirectory.empty()) {
+		return sealedDirectory + name;
+	}
+	return directory + name;
+}
+
+void KeyValueStorage::nextSegment() {
+	writeStream.close();
+	if (durability != StorageDurability::NONE) {
+		syncFile(segments[writeStreamId].file);
+	}
+	segments[writeStreamId].sealed = true;
+	writeStreamId = nextSegmentId++;
+	std::string file = segmentFile(writeStreamId, false);
+
+	writeStream.open(file, std::ios::binary | std::ios::trunc);
+	writeStream.close();
+	addSegment(writeStreamId, file, false);
+	if (!saveManifest()) {
+		log(LogLevel::WARNING, "Storage", "failed to write segment manifest %s", manifestFile.c_str());
+	}
+
+	writeStream.open(file, std::ios::binary | std::ios::app);
+	writeStream.seekp(0, std::ios::end);
+}
+
+void KeyValueStorage::syncFiles() {
+	syncFile(segments[writeStreamId].file);
+	syncFile(index.file);
+	segments[writeStreamId].durableSize = segments[writeStreamId].size;
+	unsynced = false;
+}
+
+void KeyValueStorage::stopSyncThread() {
+	if (syncThread) {
+		syncRunning = false;
+		syncCondition.notify_all();
+		if (syncThread->joinable()) {
+			syncThread->join();
+		}
+		else {
+			syncThread->detach();
+		}
+		delete syncThread;
+		syncThread = nullptr;
+	}
+}
+
+void KeyValueStorage::stopCompactionThread() {
+	if (compactionThread) {
+		{
+			std::unique_lock<std::mutex> lock(compactionWaitMutex);
+			compactionRunning = false;
+			compactionAbort = true;
+		}
+		compactionCondition.notify_all();
+		if (compactionThread->joinable()) {
+			compactionThread->join();
+		}
+		else {
+			compactionThread->detach();
+		}
+		delete compactionThread;
+		compactionThread = nullptr;
+		compactionAbort = false;
+	}
+}
+
+void KeyValueStorage::addSegment(int fileId, const std::string& file, bool sealed, bool compressed) {
+	if (fileId >= (int)segments.size()) {
+		segments.resize(fileId + 1);
+	}
+	Segment& segment = segments[fileId];
+	segment.file = file;
+	segment.sealed = sealed;
+	std::error_code error;
+	segment.size = std::filesystem::file_size(segment.file, error);
+	segment.map = std::make_shared<MappedFile>();
+	//sealed segments don't grow, so they don't need spare address space
+	segment.map->open(segment.file, sealed ? 0 : maxSegmentSize);
+	segment.compressed = nullptr;
+	if (compressed) {
+		//a damaged segment is kept, reads from it fail instead of returning wrong data
+		segment.compressed = std::make_shared<CompressedSegment>();
+		if (!segment.compressed->open(segment.map, fileId)) {
+			log(LogLevel::WARNING, "Storage", "compressed segment %s is damaged", file.c_str());
+		}
+		segment.size = segment.compressed->size();
+	}
+}
+
+bool KeyValueStorage::loadManifest() {
+	std::ifstream in(manifestFile, std::ios::binary);
+	int version = read<int>(in);
+	int count = read<int>(in);
+	if (!in || version < 1 || version > 3) {
+		return false;
+	}
+	for (int i = 0; i < count; i++) {
+		int fileId = read<int>(in);
+		bool sealed = read<bool>(in);
+		bool compressed = version >= 2 ? read<bool>(in) : false;
+		int format = version >= 3 ? read<int>(in) : 1;
+		uint64_t size = read<uint64_t>(in);
+		std::string file = readStr(in);
+		if (!in || fileId < 0) {
+			return false;
+		}
+		//segments in the storage directory are stored without a path, so the directory can be moved
+		if (!std::filesystem::path(file).has_parent_path()) {
+			file = directory + "/" + file;
+		}
+		if (!std::filesystem::exists(file)) {
+			log(LogLevel::WARNING, "Storage", "segment %s is missing", file.c_str());
+			continue;
+		}
+		addSegment(fileId, file, sealed, compressed);
+		segments[fileId].format = format;
+		segments[fileId].durableSize = std::min(size, segments[fileId].size);
+		if (sealed && segments[fileId].size != size) {
+			log(LogLevel::WARNING, "Storage", "segment %s has %llu bytes instead of %llu", file.c_str(), (unsigned long long)segments[fileId].size, (unsigned long long)size);
+		}
+	}
+	return true;
+}
+
+bool KeyValueStorage::saveManifest() {
+	std::string buffer;
+	int count = 0;
+	for (auto& segment : segments) {
+		if (segment.map) {
+			count++;
+		}
+	}
+	append(buffer, (int)3);
+	append(buffer, count);
+	for (int i = 0; i < (int)segments.size(); i++) {
+		Segment& segment = segments[i];
+		if (segment.map) {
+			std::filesystem::path path(segment.file);
+			append(buffer, i);
+			append(buffer, segment.sealed);
+			append(buffer, (bool)segment.compressed);
+			append(buffer, segment.format);
+			//for the active segment only the synced part is recorded
+			append(buffer, segment.sealed ? segment.size : segment.durableSize);
+			appendStr(buffer, path.parent_path() == std::filesystem::path(directory) ? path.filename().string() : segment.file);
+		}
+	}
+
+	std::string tmp = manifestFile + ".tmp";
+	std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+	out.write(buffer.data(), buffer.size());
+	out.close();
+	if (!out) {
+		return false;
+	}
+	syncFile(tmp);
+	std::error_code error;
+	std::filesystem::rename(tmp, manifestFile, error);
+	return !error;
+}
+
+std::vector<int> KeyValueStorage::findSegments() {
+	std::vector<int> ids;
+	std::error_code error;
+	for (auto& file : std::filesystem::directory_iterator(directory, error)) {
+		std::string name = file.path().filename().string();
+		if (name.size() > 8 && name.compare(0, 4, "data") == 0 && name.compare(name.size() - 4, 4, ".dat") == 0) {
+			std::string number = name.substr(4, name.size() - 8);
+			if (std::all_of(number.begin(), number.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+				ids.push_back(std::stoi(number));
+			}
+		}
+	}
+	std::sort(ids.begin(), ids.end());
+	return ids;
+}
+
+bool KeyValueStorage::migrateIndex() {
+	//entries of version 1 don't contain the value sizes, they are read from the segments once
+	//logs of version 2 only lack the checksums, their entries are taken as they are
+	std::vector<std::pair<std::string_view, Index::Entry>> merged;
+	index.forEach([&](std::string_view key, const Index::Entry& entry) {
+		Index::Entry converted = entry;
+		if (index.legacy) {
+			int size = 0;
+			if (entry.fileId >= 0 && entry.fileId < (int)segments.size()) {
+				Segment& segment = segments[entry.fileId];
+				if (segment.map && segment.map->contains(entry.offset, sizeof(size))) {
+					memcpy(&size, segment.map->data() + entry.offset, sizeof(size));
+				}
+			}
+			converted.size = std::max(size, 0);
+		}
+		merged.push_back({ key, converted });
+	});
+
+	std::string checkpointTmp = index.checkpointFile + ".tmp";
+	if (!Index::Checkpoint::write(checkpointTmp, merged)) {
+		return false;
+	}
+	merged.clear();
+	index.header.version = Index::Header().version;
+	std::string logTmp = index.file + ".tmp";
+	std::ofstream out(logTmp, std::ios::binary | std::ios::trunc);
+	::write(out, index.header);
+	out.close();
+	if (!out) {
+		return false;
+	}
+	syncFile(logTmp);
+
+	//same order as in checkpoint, a crash in between replays the old log again and repeats the conversion
+	std::error_code error;
+	index.checkpoint = nullptr;
+	std::filesystem::rename(checkpointTmp, index.checkpointFile, error);
+	if (error) {
+		return false;
+	}
+	index.stream.close();
+	std::filesystem::rename(logTmp, index.file, error);
+	index.stream.open(index.file, std::ios::binary | std::ios::app);
+	if (error) {
+		return false;
+	}
+
+	index.entries.clear();
+	index.frozen.clear();
+	auto table = std::make_shared<Index::Checkpoint>();
+	if (!table->open(index.checkpointFile)) {
+		return false;
+	}
+	index.checkpoint = table;
+	index.legacy = false;
+	log(LogLevel::INFO, "Storage", "converted index %s to version %i", index.file.c_str(), index.header.version);
+	return true;
+}
+
+void KeyValueStorage::recoverSegment(int fileId) {
+	Segment& segment = segments[fileId];
+	if (segment.format < 2 || segment.durableSize >= segment.size) {
+		//records without checksums can't be checked
+		segment.durableSize = segment.size;
+		return;
+	}
+
+	//only the records behind the last recovery point can be torn
+	uint64_t offset = segment.durableSize;
+	uint64_t end = segment.size;
+	if (!segment.map->contains(0, end)) {
+		return;
+	}
+	while (offset + sizeof(int) + sizeof(uint32_t) <= end) {
+		int size = 0;
+		uint32_t crc = 0;
+		memcpy(&size, segment.map->data() + offset, sizeof(size));
+		memcpy(&crc, segment.map->data() + offset + sizeof(size), sizeof(crc));
+		uint64_t bytes = sizeof(size) + sizeof(crc) + (uint64_t)size;
+		if (size < 0 || offset + bytes > end) {
+			break;
+		}
+		if (recordChecksum(std::string_view(segment.map->data() + offset + sizeof(size) + sizeof(crc), size)) != crc) {
+			break;
+		}
+		offset += bytes;
+	}
+	recoveryStats.dataBytesScanned = offset - segment.durableSize;
+	if (offset == end) {
+		segment.durableSize = end;
+		return;
+	}
+
+	//the file is reopened, windows can't truncate a file that is mapped
+	std::string file = segment.file;
+	segment.map = nullptr;
+	std::error_code error;
+	std::filesystem::resize_file(file, offset, error);
+	addSegment(fileId, file, false);
+	if (error) {
+		log(LogLevel::WARNING, "Storage", "failed to truncate segment %s", file.c_str());
+		return;
+	}
+	recoveryStats.dataBytesDropped = end - offset;
+
+	//the index log is written after the data, so it can reference records that never fully reached the disk
+	std::vector<std::string> dropped;
+	for (auto& i : index.entries) {
+		if (i.second.fileId == fileId && (uint64_t)i.second.offset + recordSize(segments[fileId], i.second) > offset) {
+			dropped.push_back(i.first);
+		}
+	}
+	for (auto& key : dropped) {
+		index.remove(key);
+	}
+	index.flush();
+	recoveryStats.entriesDropped = dropped.size();
+	segments[fileId].durableSize = offset;
+	log(LogLevel::WARNING, "Storage", "dropped %llu torn bytes from segment %s and %i index entries that referenced them",
+		(unsigned long long)(end - offset), file.c_str(), (int)dropped.size());
+}
+
+uint64_t KeyValueStorage::recordHeaderSize(const Segment& segment) {
+	return segment.format >= 2 ? sizeof(int) + sizeof(uint32_t) : sizeof(int);
+}
+
+uint64_t KeyValueStorage::recordSize(const Segment& segment, const Index::Entry& entry) {
+	return recordHeaderSize(segment) + entry.size;
+}
+
+KeyValueStorage::View KeyValueStorage::readView(const Index::Entry& entry, std::shared_lock<std::shared_mutex>& lock) {
+	if (entry.fileId < 0 || entry.fileId >= (int)segments.size() || !segments[entry.fileId].map) {
+		return View();
+	}
+	if (segments[entry.fileId].compressed) {
+		View view;
+		std::string_view record;
+		if (!readRecord(segments[entry.fileId], entry, record, view.buffer)) {
+			return View();
+		}
+		view.data = record.substr(recordHeaderSize(segments[entry.fileId]));
+		return view;
+	}
+
+	uint64_t segmentSize = segments[entry.fileId].size;
+	uint64_t headerSize = recordHeaderSize(segments[entry.fileId]);
+	std::shared_ptr<MappedFile> map = segments[entry.fileId].map;
+	if (!map->contains(0, segmentSize)) {
+		lock.unlock();
+		map = remap(entry.fileId, segmentSize);
+		lock.lock();
+	}
+
+	uint64_t begin = (uint64_t)entry.offset + headerSize;
+	if (!map || begin > segmentSize || !map->contains(0, segmentSize)) {
+		return View();
+	}
+	int size = 0;
+	memcpy(&size, map->data() + entry.offset, sizeof(size));
+	if (size < 0 || begin + size > segmentSize) {
+		return View();
+	}
+
+	View view;
+	view.file = map;
+	view.data = std::string_view(map->data() + begin, size);
+	return view;
+}
+
+bool KeyValueStorage::readRecord(const Segment& segment, const Index::Entry& entry, std::string_view& record, std::shared_ptr<const std::string>& buffer) {
+	uint64_t bytes = recordSize(segment, entry);
+	if (!segment.map || entry.offset < 0) {
+		return false;
+	}
+	if (segment.compressed) {
+		if (!segment.compressed->read(entry.offset, bytes, blockCache, record, buffer)) {
+			return false;
+		}
+	}
+	else {
+		if (!segment.map->contains(entry.offset, bytes)) {
+			return false;
+		}
+		record = std::string_view(segment.map->data() + entry.offset, bytes);
+	}
+	int size = -1;
+	memcpy(&size, record.data(), sizeof(size));
+	return size == (int)entry.size;
+}
+
+std::shared_ptr<MappedFile> KeyValueStorage::remap(int fileId, uint64_t size) {
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	Segment& segment = segments[fileId];
+	if (segment.map && !segment.map->contains(0, size)) {
+		//readers might still hold views into the old mapping, so it is replaced instead of remapped in place
+		auto map = std::make_shared<MappedFile>();
+		if (map->open(segment.file, segment.sealed ? 0 : maxSegmentSize)) {
+			segment.map = map;
+		}
+	}
+	return segment.map;
 }
 
 bool KeyValueStorage::Index::load() {
+	entries.clear();
+	frozen.clear();
+	checkpoint = nullptr;
+	count = 0;
+	legacy = false;
+	droppedBytes = 0;
+	if (std::filesystem::exists(checkpointFile)) {
+		auto table = std::make_shared<Checkpoint>();
+		if (!table->open(checkpointFile)) {
+			return false;
+		}
+		checkpoint = table;
+		count = table->header.count;
+		legacy = table->header.entrySize != sizeof(Entry);
+	}
+
 	std::ifstream in(file, std::ios::binary);
 	if (in.is_open()) {
 		Header tmp = header;
-		read<Header>(in);
+		header = read<Header>(in);
 
-		if (header.version != tmp.version) {
+		if (header.version < 1 || header.version > tmp.version) {
 			return false;
 		}
 		if (header.keySize != tmp.keySize) {
@@ -175,16 +1271,61 @@ bool KeyValueStorage::Index::load() {
 			return false;
 		}
 
-		while (!in.eof()) {
+		if (header.version == tmp.version) {
+			//records are [key][entry][checksum], the log is replayed up to the first record that is torn or damaged
+			in.seekg(0, std::ios::end);
+			uint64_t fileSize = in.tellg();
+			std::string data(fileSize > sizeof(header) ? fileSize - sizeof(header) : 0, '\0');
+			in.seekg(sizeof(header));
+			in.read(data.data(), data.size());
+			uint64_t position = 0;
+			while (position < data.size()) {
+				int size = -1;
+				if (data.size() - position < sizeof(size)) {
+					break;
+				}
+				memcpy(&size, data.data() + position, sizeof(size));
+				uint64_t bytes = sizeof(size) + (uint64_t)size + sizeof(Entry);
+				if (size < 0 || data.size() - position < bytes + sizeof(uint32_t)) {
+					break;
+				}
+				uint32_t crc = 0;
+				memcpy(&crc, data.data() + position + bytes, sizeof(crc));
+				if (checksum(data.data() + position, bytes) != crc) {
+					break;
+				}
+				Entry entry;
+				memcpy(&entry, data.data() + position + sizeof(size) + size, sizeof(entry));
+				if (size > 0) {
+					apply(std::string(data.data() + position + sizeof(size), size), entry);
+				}
+				position += bytes + sizeof(crc);
+			}
+			if (position < data.size()) {
+				in.close();
+				droppedBytes = data.size() - position;
+				std::error_code error;
+				std::filesystem::resize_file(file, sizeof(header) + position, error);
+				log(LogLevel::WARNING, "Storage", "dropped %llu torn bytes from the end of index %s", (unsigned long long)droppedBytes, file.c_str());
+			}
+		}
+		while (!in.eof() && header.version != tmp.version) {
 			std::string key = readStr(in);
 			if (!key.empty()) {
-				Entry entry = read<Entry>(in);
-				if (entry.offset == -1 && entry.fileId == -1) {
-					entries.erase(key);
+				Entry entry;
+				if (header.version == 1) {
+					LegacyEntry old = read<LegacyEntry>(in);
+					entry.fileId = old.fileId;
+					entry.offset = old.offset;
+					legacy = true;
 				}
 				else {
-					entries[key] = entry;
+					entry = read<Entry>(in);
+				}
+				if (!in) {
+					break;
 				}
+				apply(key, entry);
 			}
 		}
 
@@ -194,31 +1335,225 @@ bool KeyValueStorage::Index::load() {
 	}
 	else {
 		stream.open(file, std::ios::binary | std::ios::app);
-		write(stream, header);
+		::write(stream, header);
 	}
+	return true;
 }
 
 void KeyValueStorage::Index::set(const std::string& key, Entry entry) {
-	entries[key] = entry;
-	writeStr(stream, key);
-	write(stream, entry);
-	stream.flush();
+	apply(key, entry);
+	uint64_t begin = pending.size();
+	appendStr(pending, key);
+	append(pending, entry);
+	append(pending, checksum(pending.data() + begin, pending.size() - begin));
 }
 
-bool KeyValueStorage::Index::has(const std::string& key) {
-	return entries.find(key) != entries.end();
+bool KeyValueStorage::Index::has(std::string_view key) {
+	Entry entry;
+	return find(key, entry);
 }
 
-KeyValueStorage::Index::Entry KeyValueStorage::Index::get(const std::string& key) {
-	return entries.find(key)->second;
+KeyValueStorage::Index::Entry KeyValueStorage::Index::get(std::string_view key) {
+	Entry entry;
+	if (!find(key, entry)) {
+		return Entry();
+	}
+	return entry;
 }
 
 void KeyValueStorage::Index::remove(const std::string& key) {
-	entries.erase(key);
 	Entry entry;
 	entry.fileId = -1;
 	entry.offset = -1;
-	writeStr(stream, key);
-	write(stream, entry);
-	stream.flush();
+	apply(key, entry);
+	uint64_t begin = pending.size();
+	appendStr(pending, key);
+	append(pending, entry);
+	append(pending, checksum(pending.data() + begin, pending.size() - begin));
+}
+
+void KeyValueStorage::Index::flush() {
+	if (!pending.empty()) {
+		stream.write(pending.data(), pending.size());
+		stream.flush();
+		pending.clear();
+	}
+}
+
+void KeyValueStorage::Index::apply(const std::string& key, Entry entry) {
+	bool existed = has(key);
+	if (entry.fileId == -1) {
+		if (existed) {
+			count--;
+		}
+		if (checkpoint || !frozen.empty()) {
+			entry.offset = -1;
+			entries[key] = entry;
+		}
+		else {
+			entries.erase(key);
+		}
+	}
+	else {
+		if (!existed) {
+			count++;
+		}
+		entries[key] = entry;
+	}
+}
+
+bool KeyValueStorage::Index::find(std::string_view key, Entry& entry) {
+	auto i = entries.find(key);
+	if (i != entries.end()) {
+		entry = i->second;
+		return entry.fileId != -1;
+	}
+	i = frozen.find(key);
+	if (i != frozen.end()) {
+		entry = i->second;
+		return entry.fileId != -1;
+	}
+	if (checkpoint) {
+		return checkpoint->find(key, entry);
+	}
+	return false;
+}
+
+bool KeyValueStorage::Index::Checkpoint::open(const std::string& file) {
+	if (!map.open(file)) {
+		return false;
+	}
+	if (!map.contains(0, sizeof(header))) {
+		return false;
+	}
+	memcpy(&header, map.data(), sizeof(header));
+	if (header.version != Header().version || header.keyWidth < 0) {
+		return false;
+	}
+	if (header.entrySize != sizeof(Entry) && header.entrySize != sizeof(LegacyEntry)) {
+		return false;
+	}
+	if ((header.slotCount & (header.slotCount - 1)) != 0 || header.count > header.slotCount) {
+		return false;
+	}
+	return map.contains(0, sizeof(header) + header.slotCount * slotSize());
+}
+
+bool KeyValueStorage::Index::Checkpoint::find(std::string_view key, Entry& entry) const {
+	if (header.slotCount == 0) {
+		return false;
+	}
+	uint64_t keyHash = checkpointHash(key);
+	uint64_t mask = header.slotCount - 1;
+	for (uint64_t i = keyHash & mask, probes = 0; probes < header.slotCount; i = (i + 1) & mask, probes++) {
+		const char* data = slot(i);
+		uint64_t slotHash = 0;
+		memcpy(&slotHash, data, sizeof(slotHash));
+		if (slotHash == 0) {
+			return false;
+		}
+		if (slotHash == keyHash && slotKey(data) == key) {
+			entry = slotEntry(data);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool KeyValueStorage::Index::Checkpoint::write(const std::string& file, const std::vector<std::pair<std::string_view, Entry>>& entries) {
+	Checkpoint checkpoint;
+	Header& header = checkpoint.header;
+	header.count = entries.size();
+	header.keyWidth = entries.empty() ? 0 : entries[0].first.size();
+	for (auto& i : entries) {
+		if ((int)i.first.size() != header.keyWidth) {
+			header.keyWidth = 0;
+			break;
+		}
+	}
+
+	//at most half of the slots are used, so probe sequences stay short
+	header.slotCount = 16;
+	while (header.slotCount < entries.size() * 2) {
+		header.slotCount *= 2;
+	}
+
+	uint64_t slotSize = checkpoint.slotSize();
+	uint64_t mask = header.slotCount - 1;
+	std::string table(header.slotCount * slotSize, '\0');
+	std::string keys;
+	for (auto& i : entries) {
+		uint64_t keyHash = checkpointHash(i.first);
+		uint64_t index = keyHash & mask;
+		uint64_t slotHash = 0;
+		memcpy(&slotHash, table.data() + index * slotSize, sizeof(slotHash));
+		while (slotHash != 0) {
+			index = (index + 1) & mask;
+			memcpy(&slotHash, table.data() + index * slotSize, sizeof(slotHash));
+		}
+		char* data = table.data() + index * slotSize;
+		memcpy(data, &keyHash, sizeof(keyHash));
+		memcpy(data + sizeof(keyHash), &i.second, sizeof(i.second));
+		if (header.keyWidth > 0) {
+			memcpy(data + sizeof(keyHash) + sizeof(i.second), i.first.data(), header.keyWidth);
+		}
+		else {
+			uint64_t keyOffset = sizeof(header) + table.size() + keys.size();
+			memcpy(data + sizeof(keyHash) + sizeof(i.second), &keyOffset, sizeof(keyOffset));
+			int size = i.first.size();
+			keys.append((char*)&size, sizeof(size));
+			keys.append(i.first);
+		}
+	}
+
+	std::ofstream out(file, std::ios::binary | std::ios::trunc);
+	out.write((char*)&header, sizeof(header));
+	out.write(table.data(), table.size());
+	out.write(keys.data(), keys.size());
+	out.close();
+	if (!out) {
+		return false;
+	}
+	syncFile(file);
+	return true;
+}
+
+uint64_t KeyValueStorage::Index::Checkpoint::slotSize() const {
+	return sizeof(uint64_t) + header.entrySize + (header.keyWidth > 0 ? header.keyWidth : sizeof(uint64_t));
+}
+
+KeyValueStorage::Index::Entry KeyValueStorage::Index::Checkpoint::slotEntry(const char* slot) const {
+	Entry entry;
+	if (header.entrySize == sizeof(LegacyEntry)) {
+		LegacyEntry old;
+		memcpy(&old, slot + sizeof(uint64_t), sizeof(old));
+		entry.fileId = old.fileId;
+		entry.offset = old.offset;
+	}
+	else {
+		memcpy(&entry, slot + sizeof(uint64_t), sizeof(entry));
+	}
+	return entry;
+}
+
+const char* KeyValueStorage::Index::Checkpoint::slot(uint64_t index) const {
+	return map.data() + sizeof(header) + index * slotSize();
+}
+
+std::string_view KeyValueStorage::Index::Checkpoint::slotKey(const char* slot) const {
+	const char* key = slot + sizeof(uint64_t) + header.entrySize;
+	if (header.keyWidth > 0) {
+		return std::string_view(key, header.keyWidth);
+	}
+	uint64_t keyOffset = 0;
+	int size = 0;
+	memcpy(&keyOffset, key, sizeof(keyOffset));
+	if (!map.contains(keyOffset, sizeof(size))) {
+		return std::string_view();
+	}
+	memcpy(&size, map.data() + keyOffset, sizeof(size));
+	if (size < 0 || !map.contains(keyOffset + sizeof(size), size)) {
+		return std::string_view();
+	}
+	return std::string_view(map.data() + keyOffset + sizeof(size), size);
 }
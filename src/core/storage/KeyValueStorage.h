@@ -4,36 +4,171 @@
 
 #pragma once
 
+#include "MappedFile.h"
+#include "StorageCache.h"
+#include "KeyHash.h"
+#include "CompressedSegment.h"
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <fstream>
 #include <memory>
 #include <vector>
 #include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <cstring>
+
+enum class StorageDurability {
+	//data is handed to the os after every batch but never explicitly synced
+	NONE,
+	//data and index are synced to disk after every batch
+	BATCH,
+	//a background thread syncs data and index periodically
+	PERIODIC,
+};
+
+//what init had to drop after a crash, torn records at the end of the index log and the active segment
+class StorageRecoveryStats {
+public:
+	uint64_t indexBytesDropped = 0;
+	uint64_t dataBytesScanned = 0;
+	uint64_t dataBytesDropped = 0;
+	//index entries that pointed to dropped records
+	uint64_t entriesDropped = 0;
+};
 
 class KeyValueStorage {
 public:
+	//collects sets and removes that are written with a single append and flush
+	class WriteBatch {
+	public:
+		void set(const std::string& key, const std::string& value);
+		void remove(const std::string& key);
+		void clear();
+		bool empty() const;
+		int size() const;
+		//appends the operations of another batch
+		void append(const WriteBatch& batch);
+
+		template<typename T>
+		void set(const T& key, const std::string& value) {
+			set(std::string((char*)&key, sizeof(key)), value);
+		}
+
+		template<typename T>
+		void remove(const T& key) {
+			remove(std::string((char*)&key, sizeof(key)));
+		}
+
+	private:
+		friend class KeyValueStorage;
+		class Operation {
+		public:
+			std::string key;
+			std::string value;
+			bool remove = false;
+		};
+		std::vector<Operation> operations;
+	};
+
+	//borrowed value that points directly into a memory mapped data segment or a decompressed block
+	//the data stays valid as long as the view is alive
+	class View {
+	public:
+		std::string_view data;
+		std::shared_ptr<MappedFile> file;
+		std::shared_ptr<const std::string> buffer;
+
+		bool empty() const;
+		std::string toString() const;
+	};
+
+	~KeyValueStorage();
 	bool init(const std::string& directory, int keySize = 0, int valueSize = 0);
-	bool has(const std::string &key);
-	std::string get(const std::string &key);
+	bool has(std::string_view key);
+	std::string get(std::string_view key);
+	View getView(std::string_view key);
 	void set(const std::string &key, const std::string &value);
 	void remove(const std::string &key);
+	void write(const WriteBatch& batch);
+
+	//reads the values of all keys in file order with a single lock, missing keys result in an empty value
+	std::vector<std::string> getMany(const std::vector<std::string_view>& keys);
+
+	void setDurability(StorageDurability durability, int syncIntervalMilliseconds = 1000);
+	//forces all written data to disk
+	void sync();
+	StorageRecoveryStats getRecoveryStats();
+
+	//replaces the value cache, e.g. to use a different shard count
+	void setCache(const std::shared_ptr<StorageCache> &cache);
+	void setCacheSize(uint64_t bytes);
+	StorageCacheStats getCacheStats();
+
+	//rewrites the live records of sealed segments with at least minGarbageRatio unreachable bytes into new segments,
+	//deletes the old segments and replaces the index log with a compacted index
+	//readers and writers are only blocked while the index is swapped, the copying happens without the lock
+	void compact(float minGarbageRatio = 0.5f);
+	//runs compact periodically in a background thread, an interval of 0 disables it
+	void setCompaction(int intervalSeconds, uint64_t bytesPerSecond = 16 * 1024 * 1024);
+	//writes the index into a memory mapped checkpoint and truncates the index log,
+	//so startup only has to replay the changes since then, compact creates checkpoints automatically
+	void checkpoint();
+
+	//the active segment is sealed and a new one is started when it would grow beyond this size
+	void setMaxSegmentSize(uint64_t bytes);
+	//sealed segments are immutable, compact moves them into this directory, e.g. on a slower and cheaper volume
+	void setSealedDirectory(const std::string& directory);
+	//sealed segments are compressed in blocks when compact moves them, reads decompress whole blocks into a separate cache
+	void setCompression(bool enabled, uint64_t blockCacheSize = 32 * 1024 * 1024);
+	StorageCacheStats getBlockCacheStats();
+
+	bool has(const std::string& key) {
+		return has(std::string_view(key));
+	}
+
+	std::string get(const std::string& key) {
+		return get(std::string_view(key));
+	}
+
+	View getView(const std::string& key) {
+		return getView(std::string_view(key));
+	}
 
+	//fixed size keys like Hash are looked up in place without copying them into a string
 	template<typename T>
 	bool has(const T& key) {
-		return has(std::string((char*)&key, sizeof(key)));
+		return has(std::string_view((char*)&key, sizeof(key)));
 	}
 
 	template<typename T>
 	std::string get(const T& key) {
-		return get(std::string((char*)&key, sizeof(key)));
+		return get(std::string_view((char*)&key, sizeof(key)));
 	}
-	
+
+	template<typename T>
+	View getView(const T& key) {
+		return getView(std::string_view((char*)&key, sizeof(key)));
+	}
+
+	template<typename T>
+	std::vector<std::string> getMany(const std::vector<T>& keys) {
+		std::vector<std::string_view> views;
+		views.reserve(keys.size());
+		for (auto& key : keys) {
+			views.push_back(std::string_view((char*)&key, sizeof(key)));
+		}
+		return getMany(views);
+	}
+
 	template<typename T>
 	void set(const T& key, const std::string& value) {
 		return set(std::string((char*)&key, sizeof(key)), value);
 	}
-	
+
 	template<typename T>
 	void remove(const T& key) {
 		return remove(std::string((char*)&key, sizeof(key)));
@@ -44,36 +179,185 @@ private:
 	public:
 		class Header {
 		public:
-			int version = 1;
+			int version = 3;
 			int keySize = 0;
 			int valueSize = 0;
 		};
 
 		class Entry {
+		public:
+			int fileId = -1;
+			//size of the value, so the live bytes of a segment are known without reading it
+			uint32_t size = 0;
+			int64_t offset = 0;
+		};
+
+		//entry of version 1 index files, converted when loading
+		class LegacyEntry {
 		public:
 			int fileId = -1;
 			int offset = 0;
 		};
-		
-		std::unordered_map<std::string, Entry> entries;
+
+		//immutable snapshot of the index as an open addressed hash table that is probed directly in a memory mapping
+		//slots are [hash][entry][key], if all keys have the same size the key is stored inline,
+		//otherwise the slot holds the offset of the length prefixed key behind the table
+		class Checkpoint {
+		public:
+			class Header {
+			public:
+				int version = 2;
+				int entrySize = sizeof(Entry);
+				int keyWidth = 0;
+				int reserved = 0;
+				uint64_t count = 0;
+				uint64_t slotCount = 0;
+			};
+
+			MappedFile map;
+			Header header;
+
+			bool open(const std::string& file);
+			bool find(std::string_view key, Entry& entry) const;
+			static bool write(const std::string& file, const std::vector<std::pair<std::string_view, Entry>>& entries);
+
+			template<typename Callback>
+			void forEach(const Callback& callback) const {
+				for (uint64_t i = 0; i < header.slotCount; i++) {
+					const char* data = slot(i);
+					uint64_t slotHash = 0;
+					memcpy(&slotHash, data, sizeof(slotHash));
+					if (slotHash != 0) {
+						callback(slotKey(data), slotEntry(data));
+					}
+				}
+			}
+
+		private:
+			Entry slotEntry(const char* slot) const;
+			uint64_t slotSize() const;
+			const char* slot(uint64_t index) const;
+			std::string_view slotKey(const char* slot) const;
+		};
+
+		//changes since the last checkpoint, removed keys are kept with a fileId of -1 to hide older entries
+		std::unordered_map<std::string, Entry, KeyHash, std::equal_to<>> entries;
+		//changes that are currently written into the next checkpoint
+		std::unordered_map<std::string, Entry, KeyHash, std::equal_to<>> frozen;
+		std::shared_ptr<Checkpoint> checkpoint;
+		//number of live keys
+		uint64_t count = 0;
 		std::string file;
+		std::string checkpointFile;
 		std::ofstream stream;
 		Header header;
 
+		//index changes that are not yet written to the file
+		std::string pending;
+		//the log or checkpoint uses the old entry layout and has to be rewritten
+		bool legacy = false;
+		//size of the torn records that were cut from the end of the log
+		uint64_t droppedBytes = 0;
+
 		bool load();
 		void set(const std::string &key, Entry entry);
-		bool has(const std::string& key);
-		Entry get(const std::string& key);
+		bool has(std::string_view key);
+		Entry get(std::string_view key);
 		void remove(const std::string& key);
+		void flush();
+		void apply(const std::string& key, Entry entry);
+		bool find(std::string_view key, Entry& entry);
+
+		//calls the callback for every live key with the newest entry
+		template<typename Callback>
+		void forEach(const Callback& callback) {
+			for (auto& i : entries) {
+				if (i.second.fileId != -1) {
+					callback(std::string_view(i.first), i.second);
+				}
+			}
+			for (auto& i : frozen) {
+				if (i.second.fileId != -1 && entries.find(i.first) == entries.end()) {
+					callback(std::string_view(i.first), i.second);
+				}
+			}
+			if (checkpoint) {
+				checkpoint->forEach([&](std::string_view key, const Entry& entry) {
+					if (entries.find(key) == entries.end() && frozen.find(key) == frozen.end()) {
+						callback(key, entry);
+					}
+				});
+			}
+		}
 	};
 
+	class Segment {
+	public:
+		std::string file;
+		std::shared_ptr<MappedFile> map;
+		//size of the uncompressed data
+		uint64_t size = 0;
+		//sealed segments are never written again
+		bool sealed = false;
+		std::shared_ptr<CompressedSegment> compressed;
+		//records are [size][value] in format 1 and [size][checksum][value] in format 2
+		int format = 2;
+		//bytes of the active segment that are known to be on disk, recovery only checks the records behind them
+		uint64_t durableSize = 0;
+	};
 
 	Index index;
 	std::string directory;
-	std::unordered_map<std::string, std::string> cache;
-	std::vector<std::shared_ptr<std::ifstream>> streams;
+	std::string sealedDirectory;
+	//lists all segments with their location, so stores with many segments don't have to search for them
+	std::string manifestFile;
+	std::shared_ptr<StorageCache> cache = std::make_shared<StorageCache>();
+	std::vector<Segment> segments;
 	std::ofstream writeStream;
-	std::mutex mutex;
+	//guards the index and the segment list, readers only take a shared lock
+	std::shared_mutex mutex;
 	int writeStreamId = 0;
-	int maxFileSize = 0;
+	int nextSegmentId = 0;
+	uint64_t maxSegmentSize = 1024 * 1024 * 1024;
+	bool compression = false;
+	BlockCache blockCache;
+
+	StorageDurability durability = StorageDurability::NONE;
+	int syncInterval = 1000;
+	bool unsynced = false;
+	std::thread* syncThread = nullptr;
+	std::atomic_bool syncRunning;
+	std::condition_variable_any syncCondition;
+	StorageRecoveryStats recoveryStats;
+
+	//serializes compaction runs
+	std::mutex compactionMutex;
+	uint64_t compactionRate = 16 * 1024 * 1024;
+	std::thread* compactionThread = nullptr;
+	std::atomic_bool compactionRunning;
+	std::atomic_bool compactionAbort;
+	std::mutex compactionWaitMutex;
+	std::condition_variable compactionCondition;
+	std::mutex checkpointMutex;
+
+	std::string segmentFile(int fileId, bool sealed, bool compressed = false);
+	void nextSegment();
+	void syncFiles();
+	void stopSyncThread();
+	void stopCompactionThread();
+	void compactSegments(float minGarbageRatio);
+	void relocateSegments();
+	void throttle(uint64_t bytes, std::chrono::steady_clock::time_point start);
+	void addSegment(int fileId, const std::string& file, bool sealed, bool compressed = false);
+	bool loadManifest();
+	bool saveManifest();
+	std::vector<int> findSegments();
+	bool migrateIndex();
+	void recoverSegment(int fileId);
+	uint64_t recordHeaderSize(const Segment& segment);
+	uint64_t recordSize(const Segment& segment, const Index::Entry& entry);
+	View readView(const Index::Entry &entry, std::shared_lock<std::shared_mutex> &lock);
+	//reads the size prefix and value of a record from a segment that is completely mapped
+	bool readRecord(const Segment& segment, const Index::Entry& entry, std::string_view& record, std::shared_ptr<const std::string>& buffer);
+	std::shared_ptr<MappedFile> remap(int fileId, uint64_t size);
 };
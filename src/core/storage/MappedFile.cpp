@@ -0,0 +1,141 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#include "MappedFile.h"
+#include <filesystem>
+
+#if WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() {
+	ptr = nullptr;
+	mappedSize = 0;
+#if WIN32
+	fileHandle = nullptr;
+	mappingHandle = nullptr;
+#else
+	fd = -1;
+#endif
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(const std::string& file, uint64_t capacity) {
+	close();
+	std::error_code error;
+	uint64_t fileSize = std::filesystem::file_size(file, error);
+	if (error) {
+		return false;
+	}
+
+#if WIN32
+	if (fileSize == 0) {
+		return true;
+	}
+	fileHandle = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE) {
+		fileHandle = nullptr;
+		return false;
+	}
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle == nullptr) {
+		close();
+		return false;
+	}
+	ptr = (char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (ptr == nullptr) {
+		close();
+		return false;
+	}
+	mappedSize = fileSize;
+#else
+	fd = ::open(file.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+	uint64_t length = std::max(capacity, fileSize);
+	if (length == 0) {
+		return true;
+	}
+	void* address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+	if (address == MAP_FAILED) {
+		close();
+		return false;
+	}
+	ptr = (char*)address;
+	mappedSize = length;
+#endif
+	return true;
+}
+
+void MappedFile::close() {
+#if WIN32
+	if (ptr) {
+		UnmapViewOfFile(ptr);
+	}
+	if (mappingHandle) {
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle) {
+		CloseHandle(fileHandle);
+	}
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+#else
+	if (ptr) {
+		munmap(ptr, mappedSize);
+	}
+	if (fd != -1) {
+		::close(fd);
+	}
+	fd = -1;
+#endif
+	ptr = nullptr;
+	mappedSize = 0;
+}
+
+bool MappedFile::isOpen() const {
+#if WIN32
+	return fileHandle != nullptr || ptr != nullptr;
+#else
+	return fd != -1;
+#endif
+}
+
+const char* MappedFile::data() const {
+	return ptr;
+}
+
+uint64_t MappedFile::size() const {
+	return mappedSize;
+}
+
+bool MappedFile::contains(uint64_t offset, uint64_t bytes) const {
+	return ptr != nullptr && offset + bytes <= mappedSize && offset + bytes >= offset;
+}
+
+void MappedFile::prefetch(uint64_t offset, uint64_t bytes) const {
+	if (!contains(offset, bytes) || bytes == 0) {
+		return;
+	}
+#if WIN32
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = ptr + offset;
+	range.NumberOfBytes = bytes;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+	//madvise needs a page aligned address
+	uint64_t pageSize = sysconf(_SC_PAGESIZE);
+	uint64_t begin = offset - offset % pageSize;
+	posix_madvise(ptr + begin, offset + bytes - begin, POSIX_MADV_WILLNEED);
+#endif
+}
@@ -0,0 +1,41 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+//read only memory mapping of a file
+//on posix systems the mapping reserves capacity bytes of address space, so data appended to the file later
+//becomes visible without remapping, on windows only the current file size is mapped
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& file, uint64_t capacity = 0);
+	void close();
+	bool isOpen() const;
+
+	const char* data() const;
+	uint64_t size() const;
+
+	//returns true if the range is covered by the mapping
+	bool contains(uint64_t offset, uint64_t bytes) const;
+	//asks the os to read the range ahead of time, so later accesses don't fault page by page
+	void prefetch(uint64_t offset, uint64_t bytes) const;
+
+private:
+	char* ptr;
+	uint64_t mappedSize;
+#if WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#else
+	int fd;
+#endif
+};
@@ -0,0 +1,113 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#include "StorageCache.h"
+
+StorageCache::StorageCache(uint64_t capacity, int shardCount) {
+	for (int i = 0; i < shardCount; i++) {
+		shards.push_back(std::make_unique<Shard>());
+	}
+	setCapacity(capacity);
+}
+
+bool StorageCache::get(std::string_view key, std::string& value) {
+	Shard& shard = getShard(key);
+	std::unique_lock<std::mutex> lock(shard.mutex);
+	auto i = shard.entries.find(key);
+	if (i == shard.entries.end()) {
+		shard.misses++;
+		return false;
+	}
+	shard.hits++;
+	shard.lru.splice(shard.lru.begin(), shard.lru, i->second);
+	value = i->second->value;
+	return true;
+}
+
+void StorageCache::set(std::string_view key, const std::string& value) {
+	Shard& shard = getShard(key);
+	std::unique_lock<std::mutex> lock(shard.mutex);
+	auto i = shard.entries.find(key);
+	if (i != shard.entries.end()) {
+		shard.erase(i->second);
+	}
+
+	uint64_t size = entrySize(key, value);
+	if (size > shard.capacity) {
+		return;
+	}
+
+	shard.lru.push_front({ std::string(key), value });
+	shard.entries[shard.lru.front().key] = shard.lru.begin();
+	shard.bytes += size;
+	shard.evict();
+}
+
+void StorageCache::remove(std::string_view key) {
+	Shard& shard = getShard(key);
+	std::unique_lock<std::mutex> lock(shard.mutex);
+	auto i = shard.entries.find(key);
+	if (i != shard.entries.end()) {
+		shard.erase(i->second);
+	}
+}
+
+void StorageCache::clear() {
+	for (auto& shard : shards) {
+		std::unique_lock<std::mutex> lock(shard->mutex);
+		shard->entries.clear();
+		shard->lru.clear();
+		shard->bytes = 0;
+	}
+}
+
+void StorageCache::setCapacity(uint64_t capacity) {
+	this->capacity = capacity;
+	for (auto& shard : shards) {
+		std::unique_lock<std::mutex> lock(shard->mutex);
+		shard->capacity = capacity / shards.size();
+		shard->evict();
+	}
+}
+
+uint64_t StorageCache::getCapacity() {
+	return capacity;
+}
+
+StorageCacheStats StorageCache::getStats() {
+	StorageCacheStats stats;
+	stats.capacity = capacity;
+	for (auto& shard : shards) {
+		std::unique_lock<std::mutex> lock(shard->mutex);
+		stats.hits += shard->hits;
+		stats.misses += shard->misses;
+		stats.evictions += shard->evictions;
+		stats.entries += shard->entries.size();
+		stats.bytes += shard->bytes;
+	}
+	return stats;
+}
+
+StorageCache::Shard& StorageCache::getShard(std::string_view key) {
+	//the low bits select the bucket inside the shard, so the shard uses the high bits
+	return *shards[(KeyHash::hash(key) >> 40) % shards.size()];
+}
+
+uint64_t StorageCache::entrySize(std::string_view key, const std::string& value) {
+	//approximate overhead of the list node and the map entry
+	return key.size() + value.size() + 96;
+}
+
+void StorageCache::Shard::erase(std::list<Entry>::iterator i) {
+	bytes -= entrySize(i->key, i->value);
+	entries.erase(i->key);
+	lru.erase(i);
+}
+
+void StorageCache::Shard::evict() {
+	while (bytes > capacity && !lru.empty()) {
+		erase(std::prev(lru.end()));
+		evictions++;
+	}
+}
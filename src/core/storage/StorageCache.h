@@ -0,0 +1,67 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include "KeyHash.h"
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+class StorageCacheStats {
+public:
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+	uint64_t entries = 0;
+	uint64_t bytes = 0;
+	uint64_t capacity = 0;
+};
+
+//value cache with a byte budget, split into independently locked shards that each evict in lru order
+class StorageCache {
+public:
+	StorageCache(uint64_t capacity = 16 * 1024 * 1024, int shardCount = 16);
+
+	bool get(std::string_view key, std::string& value);
+	void set(std::string_view key, const std::string& value);
+	void remove(std::string_view key);
+	void clear();
+
+	void setCapacity(uint64_t capacity);
+	uint64_t getCapacity();
+	StorageCacheStats getStats();
+
+private:
+	class Entry {
+	public:
+		std::string key;
+		std::string value;
+	};
+
+	class Shard {
+	public:
+		std::mutex mutex;
+		std::list<Entry> lru;
+		std::unordered_map<std::string_view, std::list<Entry>::iterator, KeyHash> entries;
+		uint64_t bytes = 0;
+		uint64_t capacity = 0;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+
+		void erase(std::list<Entry>::iterator i);
+		void evict();
+	};
+
+	std::vector<std::unique_ptr<Shard>> shards;
+	uint64_t capacity;
+
+	Shard& getShard(std::string_view key);
+	static uint64_t entrySize(std::string_view key, const std::string& value);
+};
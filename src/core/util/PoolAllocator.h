@@ -0,0 +1,195 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <new>
+
+//free lists for blocks of one size, for small objects that are created and destroyed at high rates
+//every thread keeps a small cache of free blocks, so most allocations and frees don't lock
+//blocks are handed between threads in batches and are never returned to the system
+//the pool is global rather than an arena per tree, because tree nodes are shared between tree instances and the node cache,
+//so a node can outlive the tree that created it and be freed by any thread
+//when a thread exits its cached blocks go back to the shared lists, so short lived threads don't strand them
+template<size_t blockSize>
+class BlockPool {
+public:
+	static void* allocate() {
+		Cache& cache = getCache();
+		if (!cache.list) {
+			refill(cache);
+		}
+		Block* block = cache.list;
+		cache.list = block->next;
+		cache.count--;
+		return block;
+	}
+
+	static void deallocate(void* pointer) {
+		Cache& cache = getCache();
+		if (!cache.registered) {
+			registerExit(cache);
+		}
+		Block* block = (Block*)pointer;
+		block->next = cache.list;
+		cache.list = block;
+		cache.count++;
+		if (cache.count >= batchSize * 2) {
+			release(cache);
+		}
+	}
+
+private:
+	static const int batchSize = 256;
+
+	class Block {
+	public:
+		Block* next;
+	};
+
+	//trivially destructible, so blocks can still be freed while threads and statics are destroyed
+	class Cache {
+	public:
+		Block* list;
+		int count;
+		bool registered;
+	};
+
+	//hands the blocks of the thread's cache back when the thread exits
+	class Exit {
+	public:
+		~Exit() {
+			drain(getCache());
+		}
+	};
+
+	class Shared {
+	public:
+		std::mutex mutex;
+		std::vector<Block*> batches;
+		//blocks from exited threads that don't fill a batch yet
+		Block* partial = nullptr;
+		int partialCount = 0;
+	};
+
+	static Cache& getCache() {
+		thread_local Cache cache = { nullptr, 0, false };
+		return cache;
+	}
+
+	static void registerExit(Cache& cache) {
+		thread_local Exit threadExit;
+		cache.registered = true;
+	}
+
+	static Shared& getShared() {
+		//never destroyed, objects in static storage might be freed after it
+		static Shared* shared = new Shared();
+		return *shared;
+	}
+
+	static void refill(Cache& cache) {
+		if (!cache.registered) {
+			registerExit(cache);
+		}
+		Shared& shared = getShared();
+		{
+			std::unique_lock<std::mutex> lock(shared.mutex);
+			if (!shared.batches.empty()) {
+				cache.list = shared.batches.back();
+				cache.count = batchSize;
+				shared.batches.pop_back();
+				return;
+			}
+		}
+		char* chunk = (char*)::operator new(blockSize * batchSize);
+		for (int i = 0; i < batchSize; i++) {
+			Block* block = (Block*)(chunk + i * blockSize);
+			block->next = i + 1 < batchSize ? (Block*)(chunk + (i + 1) * blockSize) : nullptr;
+		}
+		cache.list = (Block*)chunk;
+		cache.count = batchSize;
+	}
+
+	static void release(Cache& cache) {
+		Block* first = cache.list;
+		Block* last = first;
+		for (int i = 1; i < batchSize; i++) {
+			last = last->next;
+		}
+		cache.list = last->next;
+		cache.count -= batchSize;
+		last->next = nullptr;
+
+		Shared& shared = getShared();
+		std::unique_lock<std::mutex> lock(shared.mutex);
+		shared.batches.push_back(first);
+	}
+
+	//blocks freed by destructors that run after this stay in the cache of the exited thread
+	static void drain(Cache& cache) {
+		while (cache.count >= batchSize) {
+			release(cache);
+		}
+		Shared& shared = getShared();
+		std::unique_lock<std::mutex> lock(shared.mutex);
+		while (cache.list) {
+			Block* block = cache.list;
+			cache.list = block->next;
+			block->next = shared.partial;
+			shared.partial = block;
+			if (++shared.partialCount == batchSize) {
+				shared.batches.push_back(shared.partial);
+				shared.partial = nullptr;
+				shared.partialCount = 0;
+			}
+		}
+		cache.count = 0;
+	}
+};
+
+//allocator for std::allocate_shared that takes single objects from a BlockPool of their size
+template<typename T>
+class PoolAllocator {
+public:
+	typedef T value_type;
+
+	PoolAllocator() {}
+
+	template<typename U>
+	PoolAllocator(const PoolAllocator<U>&) {}
+
+	T* allocate(size_t count) {
+		if (count != 1) {
+			return (T*)::operator new(count * sizeof(T));
+		}
+		return (T*)BlockPool<blockSize>::allocate();
+	}
+
+	void deallocate(T* pointer, size_t count) {
+		if (count != 1) {
+			::operator delete(pointer);
+			return;
+		}
+		BlockPool<blockSize>::deallocate(pointer);
+	}
+
+	template<typename U>
+	bool operator==(const PoolAllocator<U>&) const {
+		return true;
+	}
+
+	template<typename U>
+	bool operator!=(const PoolAllocator<U>&) const {
+		return false;
+	}
+
+private:
+	//sizes are rounded to 16 bytes, so types of similar size share a pool and all blocks stay aligned
+	static const size_t blockSize = (sizeof(T) + 15) / 16 * 16;
+	static_assert(alignof(T) <= 16, "PoolAllocator only supports alignments up to 16 bytes");
+};
@@ -0,0 +1,86 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#include "ThreadPool.h"
+
+ThreadPool::~ThreadPool() {
+	stop();
+}
+
+void ThreadPool::start(int threadCount) {
+	stop();
+	running = true;
+	for (int i = 0; i < threadCount; i++) {
+		threads.push_back(new std::thread([&]() {
+			while (true) {
+				std::unique_lock<std::mutex> lock(mutex);
+				while (running && queue.empty()) {
+					cv.wait(lock);
+				}
+				if (!running) {
+					break;
+				}
+				std::function<void()> task = std::move(queue.front());
+				queue.pop_front();
+				lock.unlock();
+				task();
+			}
+		}));
+	}
+}
+
+void ThreadPool::stop() {
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		running = false;
+	}
+	cv.notify_all();
+	for (auto* thread : threads) {
+		if (thread->joinable()) {
+			thread->join();
+		}
+		delete thread;
+	}
+	threads.clear();
+}
+
+int ThreadPool::getThreadCount() {
+	return threads.size();
+}
+
+void ThreadPool::run(const std::vector<std::function<void()>>& tasks) {
+	if (threads.empty() || tasks.size() <= 1) {
+		for (auto& task : tasks) {
+			task();
+		}
+		return;
+	}
+
+	int remaining = tasks.size();
+	std::unique_lock<std::mutex> lock(mutex);
+	for (auto& task : tasks) {
+		queue.push_back([&, task]() {
+			task();
+			std::unique_lock<std::mutex> lock(mutex);
+			if (--remaining == 0) {
+				doneCv.notify_all();
+			}
+		});
+	}
+	cv.notify_all();
+
+	//tasks of other runs might be taken here too, but all of them are finished before they are waited on
+	while (remaining > 0) {
+		if (!queue.empty()) {
+			std::function<void()> task = std::move(queue.front());
+			queue.pop_front();
+			lock.unlock();
+			task();
+			lock.lock();
+		}
+		else {
+			doneCv.wait(lock);
+		}
+	}
+}
@@ -0,0 +1,34 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+//worker threads for splitting one job into tasks, the thread that runs the tasks waits for them and works on them too
+class ThreadPool {
+public:
+	~ThreadPool();
+
+	void start(int threadCount = std::thread::hardware_concurrency());
+	void stop();
+	int getThreadCount();
+
+	//returns when all tasks are done, without started threads the tasks are run one after another
+	void run(const std::vector<std::function<void()>>& tasks);
+
+private:
+	std::vector<std::thread*> threads;
+	std::deque<std::function<void()>> queue;
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::condition_variable doneCv;
+	std::atomic_bool running = false;
+};
@@ -168,6 +168,8 @@ void Validator::createBlock(uint32_t slot, uint64_t slotBeginTime) {
 	}
 
 	VerifyContext context = node.verifier.createContext(node.blockChain.getHeadBlock());
+	context.accountTree.beginBatch();
+	context.validators.beginBatch();
 	uint64_t startTime = nowMilli();
 	int transactionCount = 0;
 
@@ -181,15 +183,16 @@ void Validator::createBlock(uint32_t slot, uint64_t slotBeginTime) {
 		for (auto& i : node.blockChain.getPendingTransactions()) {
 			Transaction transaction = node.blockChain.getTransaction(i);
 			if (transaction.header.transactionNumber == number) {
-				VerifyContext tmp = context;
+				VerifyContext::Checkpoint checkpoint = context.checkpoint();
 				TransactionError error = node.verifier.verifyTransaction(transaction, context);
 				if (error == TransactionError::VALID) {
+					context.release(checkpoint);
 					node.creator.addTransaction(transaction);
 					transactionCount++;
 				}
 				else {
 					log(LogLevel::INFO, "Validator", "invalid transaction %s: %s", toHex(transaction.transactionHash).c_str(), transactionErrorToString(error));
-					context = tmp;
+					context.revert(checkpoint);
 					checkPendingTransaction(transaction, error);
 				}
 
@@ -247,7 +250,7 @@ void Validator::createBlock(uint32_t slot, uint64_t slotBeginTime) {
 void Validator::checkPendingTransaction(const Transaction& transaction, TransactionError result) {
 	bool keep = false;
 	if (result == TransactionError::INVALID_TRANSACTION_NUMBER) {
-		uint32_t transactionCount = node.blockChain.getAccountTree().get(transaction.header.sender).transactionCount;
+		uint32_t transactionCount = node.blockChain.getAccount(transaction.header.sender).transactionCount;
 		if (transaction.header.transactionNumber >= transactionCount) {
 			keep = true;
 		}
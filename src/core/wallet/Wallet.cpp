@@ -40,11 +40,15 @@ void Wallet::sendTransaction(const std::string &address, const std::string& amou
 	Transaction transaction = node.creator.createTransaction(keyStore.getPublicKey(), fromHex<EccPublicKey>(address), transactionNumber, coinToAmount(amount), coinToAmount(fee), type);
 	transaction.header.sign(keyStore.getPrivateKey());
 	transaction.transactionHash = transaction.header.caclulateHash();
+	VerifyContext::Checkpoint checkpoint = context.checkpoint();
 	TransactionError error = node.verifier.verifyTransaction(transaction, context);
 	if (error != TransactionError::VALID) {
 		log(LogLevel::INFO, "Wallet", "invalid transaction %s: %s", toHex(transaction.transactionHash).c_str(), transactionErrorToString(error));
+		//the context is kept for the next transaction, so the partial changes of this one are undone
+		context.revert(checkpoint);
 	}
 	else {
+		context.release(checkpoint);
 		node.blockChain.addTransaction(transaction);
 		node.blockChain.addPendingTransaction(transaction.transactionHash);
 		log(LogLevel::INFO, "Wallet", "created transaction %s", toHex(transaction.transactionHash).c_str());
@@ -56,7 +60,7 @@ Account Wallet::getAccount() {
 	if (!initialized) {
 		return Account();
 	}
-	Account account = node.blockChain.getAccountTree().get(keyStore.getPublicKey());
+	Account account = node.blockChain.getAccount(keyStore.getPublicKey());
 	return account;
 }
 
@@ -0,0 +1,29 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#pragma once
+
+#include <string>
+#include <random>
+#include <chrono>
+
+//the benchmarks behind the numbers in the commit messages, run as "test <name> [directory]" from a Release build
+void compressionBenchmark(const std::string& directory);
+void keyBenchmark(const std::string& directory);
+void hashedKeyBenchmark(const std::string& directory);
+void radixBenchmark(const std::string& directory);
+
+//a fixed seed, so every run measures the same data
+template<typename T>
+T randomValue(std::mt19937_64& rng) {
+	T output = T();
+	for (int i = 0; i < (int)sizeof(T); i++) {
+		((uint8_t*)&output)[i] = (uint8_t)rng();
+	}
+	return output;
+}
+
+inline double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
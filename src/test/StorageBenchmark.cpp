@@ -0,0 +1,104 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#include "Benchmark.h"
+#include "storage/KeyValueStorage.h"
+#include "storage/CompressedSegment.h"
+#include "blockchain/Transaction.h"
+#include "util/log.h"
+#include <filesystem>
+
+//serialized transfers between a fixed set of accounts, the same kind of records as the transaction storage
+static std::vector<std::pair<Hash, std::string>> createTransactions(std::mt19937_64& rng, int count) {
+	std::vector<EccPublicKey> accounts(1000);
+	for (auto& account : accounts) {
+		account = randomValue<EccPublicKey>(rng);
+	}
+	std::vector<std::pair<Hash, std::string>> transactions;
+	for (int i = 0; i < count; i++) {
+		Transaction transaction;
+		transaction.header.type = TransactionType::TRANSFER;
+		transaction.header.version = 1;
+		transaction.header.transactionNumber = i % 50;
+		transaction.header.timestamp = 1700000000 + i;
+		transaction.header.sender = accounts[rng() % accounts.size()];
+		transaction.header.recipient = accounts[rng() % accounts.size()];
+		transaction.header.amount = rng() % 100000;
+		transaction.header.fee = 10;
+		transaction.header.signature = randomValue<EccSignature>(rng);
+		transactions.push_back({ randomValue<Hash>(rng), transaction.serial() });
+	}
+	return transactions;
+}
+
+//size on disk and random get latency of plain and compressed segments, and the speed of the codec itself
+void compressionBenchmark(const std::string& directory) {
+	std::mt19937_64 rng(1);
+	std::vector<std::pair<Hash, std::string>> transactions = createTransactions(rng, 200000);
+
+	for (bool compression : { false, true }) {
+		std::string path = directory + (compression ? "/compressed" : "/plain");
+		KeyValueStorage storage;
+		storage.init(path);
+		storage.setMaxSegmentSize(4 * 1024 * 1024);
+		storage.setCompaction(0);
+		storage.setCompression(compression);
+		for (auto& transaction : transactions) {
+			storage.set(transaction.first, transaction.second);
+		}
+		//moves the sealed segments, which compresses them
+		storage.compact(0.5f);
+
+		uint64_t diskSize = 0;
+		for (auto& file : std::filesystem::directory_iterator(path)) {
+			if (file.path().filename().string().rfind("data", 0) == 0) {
+				diskSize += std::filesystem::file_size(file.path());
+			}
+		}
+
+		//without the value cache every get reads the segment
+		storage.setCacheSize(0);
+		auto start = std::chrono::steady_clock::now();
+		uint64_t readSize = 0;
+		const int readCount = 100000;
+		for (int i = 0; i < readCount; i++) {
+			readSize += storage.get(transactions[rng() % transactions.size()].first).size();
+		}
+		double seconds = secondsSince(start);
+
+		StorageCacheStats stats = storage.getBlockCacheStats();
+		log(LogLevel::INFO, "Benchmark", "%s: %.1f MB on disk, random get %.2f us, block cache hits %llu misses %llu",
+			compression ? "compressed" : "plain", diskSize / 1e6, seconds / readCount * 1e6,
+			(unsigned long long)stats.hits, (unsigned long long)stats.misses);
+	}
+
+	std::string data;
+	for (auto& transaction : transactions) {
+		data += transaction.second;
+	}
+	const uint64_t blockSize = 16 * 1024;
+	data.resize(data.size() / blockSize * blockSize);
+
+	std::vector<std::string> blocks(data.size() / blockSize);
+	uint64_t compressedSize = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < (int)blocks.size(); i++) {
+		lzCompress(data.data() + i * blockSize, blockSize, blocks[i]);
+		compressedSize += blocks[i].size();
+	}
+	double compressSeconds = secondsSince(start);
+
+	std::string output(blockSize, '\0');
+	const int rounds = 20;
+	start = std::chrono::steady_clock::now();
+	for (int round = 0; round < rounds; round++) {
+		for (auto& block : blocks) {
+			lzDecompress(block.data(), block.size(), output.data(), blockSize);
+		}
+	}
+	double decompressSeconds = secondsSince(start) / rounds;
+
+	log(LogLevel::INFO, "Benchmark", "codec: compress %.0f MB/s, decompress %.0f MB/s, ratio %.2f",
+		data.size() / compressSeconds / 1e6, data.size() / decompressSeconds / 1e6, (double)data.size() / compressedSize);
+}
@@ -0,0 +1,263 @@
+//
+// Copyright (c) 2024 Julian Hinxlage. All rights reserved.
+//
+
+#include "Benchmark.h"
+#include "blockchain/Account.h"
+#include "util/log.h"
+#include <filesystem>
+
+//the bit by bit versions that the word-wise key operations replaced
+template<typename KeyType>
+static int bitMatchReference(const BinaryTreeKey<KeyType>& key, const BinaryTreeKey<KeyType>& value, int bitOffset) {
+	int left = sizeof(KeyType) * 8 - bitOffset;
+	for (int i = 0; i < left; i++) {
+		if (key.getBit(i) != value.getBit(i + bitOffset)) {
+			return i;
+		}
+	}
+	return left;
+}
+
+template<typename KeyType>
+static void copyBitsReference(BinaryTreeKey<KeyType>& key, const BinaryTreeKey<KeyType>& value, int bitOffset, int bitCount) {
+	for (int i = 0; i < bitCount; i++) {
+		key.setBit(i, value.getBit(i + bitOffset));
+	}
+}
+
+//nanoseconds per call of function(i) for i in [0, count)
+template<typename Function>
+static double measure(int count, int rounds, Function function, uint64_t& checksum) {
+	auto start = std::chrono::steady_clock::now();
+	for (int round = 0; round < rounds; round++) {
+		for (int i = 0; i < count; i++) {
+			checksum += function(i);
+		}
+	}
+	return secondsSince(start) / ((double)count * rounds) * 1e9;
+}
+
+static std::vector<EccPublicKey> createAddresses(std::mt19937_64& rng, int count) {
+	std::vector<EccPublicKey> addresses(count);
+	for (auto& address : addresses) {
+		address = randomValue<EccPublicKey>(rng);
+		//compressed public keys start with 2 or 3
+		address.bytes[0] = 2 + rng() % 2;
+	}
+	return addresses;
+}
+
+//bitMatch and path copies over a full account key, and AccountTree set and get that are made of them
+void keyBenchmark(const std::string& directory) {
+	typedef BinaryTreeKey<EccPublicKey> Key;
+	const int bits = sizeof(EccPublicKey) * 8;
+	std::mt19937_64 rng(7);
+
+	//paths that match the key at an offset, as when get and set walk down to a leaf
+	const int count = 4096;
+	std::vector<Key> keys(count);
+	std::vector<Key> paths(count);
+	std::vector<int> offsets(count);
+	for (int i = 0; i < count; i++) {
+		keys[i] = Key(randomValue<EccPublicKey>(rng));
+		offsets[i] = rng() % 40;
+		paths[i].copyBits(keys[i], offsets[i], bits - offsets[i]);
+	}
+
+	uint64_t checksum = 0;
+	uint64_t referenceChecksum = 0;
+	double match = measure(count, 200, [&](int i) { return paths[i].bitMatch(keys[i], offsets[i]); }, checksum);
+	double matchReference = measure(count, 200, [&](int i) { return bitMatchReference(paths[i], keys[i], offsets[i]); }, referenceChecksum);
+	Key output;
+	double copy = measure(count, 200, [&](int i) { output.copyBits(keys[i], offsets[i], bits - offsets[i]); return output.key.bytes[3]; }, checksum);
+	double copyReference = measure(count, 200, [&](int i) { copyBitsReference(output, keys[i], offsets[i], bits - offsets[i]); return output.key.bytes[3]; }, referenceChecksum);
+	log(LogLevel::INFO, "Benchmark", "full path bitMatch: %.1f ns, bit by bit %.1f ns", match, matchReference);
+	log(LogLevel::INFO, "Benchmark", "full path copy: %.1f ns, bit by bit %.1f ns", copy, copyReference);
+	if (checksum != referenceChecksum) {
+		log(LogLevel::ERROR, "Benchmark", "word-wise and bit by bit results differ");
+	}
+
+	KeyValueStorage storage;
+	storage.init(directory);
+	std::vector<EccPublicKey> addresses = createAddresses(rng, 100000);
+	AccountTree tree;
+	tree.init(&storage);
+	auto start = std::chrono::steady_clock::now();
+	for (auto& address : addresses) {
+		Account account;
+		account.balance = rng();
+		tree.set(address, account);
+	}
+	double set = secondsSince(start) / addresses.size() * 1e9;
+	tree.getRoot();
+
+	const int rounds = 5;
+	start = std::chrono::steady_clock::now();
+	for (int round = 0; round < rounds; round++) {
+		for (auto& address : addresses) {
+			checksum += tree.get(address).balance;
+		}
+	}
+	double get = secondsSince(start) / ((double)addresses.size() * rounds) * 1e9;
+	log(LogLevel::INFO, "Benchmark", "AccountTree with %d keys: set %.0f ns, in memory get %.0f ns", (int)addresses.size(), set, get);
+}
+
+static uint64_t directorySize(const std::string& directory) {
+	uint64_t size = 0;
+	for (auto& file : std::filesystem::recursive_directory_iterator(directory)) {
+		if (file.is_regular_file()) {
+			size += file.file_size();
+		}
+	}
+	return size;
+}
+
+template<typename Tree, typename KeyType>
+static void measureAccountTree(const char* name, const std::string& directory, const std::vector<std::pair<KeyType, Account>>& accounts, const std::vector<KeyType>& probes) {
+	KeyValueStorage storage;
+	storage.init(directory);
+	Tree tree;
+	tree.init(&storage);
+	auto start = std::chrono::steady_clock::now();
+	tree.build(accounts);
+	Hash root = tree.getRoot();
+	double build = secondsSince(start);
+
+	//every get loads its nodes from storage
+	uint64_t cacheCapacity = Tree::Node::getCache().getStats().capacity;
+	Tree::Node::getCache().setCapacity(0);
+	uint64_t checksum = 0;
+	start = std::chrono::steady_clock::now();
+	for (auto& key : probes) {
+		checksum += tree.createInstance(root).get(key).balance;
+	}
+	double coldGet = secondsSince(start) / probes.size() * 1e6;
+
+	//committed every 1000 changes, as for a block
+	Tree updated = tree.createInstance(root);
+	start = std::chrono::steady_clock::now();
+	updated.beginBatch();
+	for (int i = 0; i < (int)probes.size(); i++) {
+		Account account = updated.get(probes[i]);
+		account.balance++;
+		updated.set(probes[i], account);
+		if (i % 1000 == 999) {
+			updated.commit();
+			updated.beginBatch();
+		}
+	}
+	updated.commit();
+	double update = secondsSince(start) / probes.size() * 1e6;
+
+	uint64_t diskSize = directorySize(directory);
+	uint64_t proofSize = 0;
+	const int proofCount = 2000;
+	for (int i = 0; i < proofCount; i++) {
+		proofSize += tree.getProof(probes[i]).size();
+	}
+	log(LogLevel::INFO, "Benchmark", "%s: build %.2f s, cold get %.1f us, update %.1f us, %.1f MB on disk, proof %.1f bytes (%d)",
+		name, build, coldGet, update, diskSize / 1e6, (double)proofSize / proofCount, (int)(checksum % 2));
+	Tree::Node::getCache().setCapacity(cacheCapacity);
+}
+
+//the account tree keyed by public keys against the same accounts keyed by sha256 of the public key
+void hashedKeyBenchmark(const std::string& directory) {
+	std::mt19937_64 rng(1);
+	const int count = 200000;
+	std::vector<std::pair<EccPublicKey, Account>> accounts;
+	std::vector<std::pair<Hash, Account>> hashedAccounts;
+	for (auto& address : createAddresses(rng, count)) {
+		Account account;
+		account.balance = rng() % 1000 + 1;
+		account.transactionCount = rng() % 100;
+		accounts.push_back({ address, account });
+		hashedAccounts.push_back({ sha256((char*)&address, sizeof(address)), account });
+	}
+	std::vector<EccPublicKey> probes;
+	std::vector<Hash> hashedProbes;
+	for (int i = 0; i < 20000; i++) {
+		int index = rng() % count;
+		probes.push_back(accounts[index].first);
+		hashedProbes.push_back(hashedAccounts[index].first);
+	}
+	measureAccountTree<AccountTree>("public keys", directory + "/raw", accounts, probes);
+	measureAccountTree<BinaryTree<Hash, Account, true>>("hashed keys", directory + "/hashed", hashedAccounts, hashedProbes);
+}
+
+template<typename Tree>
+static void measureTrie(const char* name, const std::string& directory, const std::vector<EccPublicKey>& addresses) {
+	std::mt19937_64 rng(9);
+	const int updateCount = 100000;
+	Hash root;
+	uint64_t buildSize = 0;
+	{
+		KeyValueStorage storage;
+		storage.init(directory);
+		Tree tree;
+		tree.init(&storage);
+
+		//roots are computed every 1000 changes, as for a block
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < (int)addresses.size(); i++) {
+			Account account;
+			account.balance = rng();
+			tree.set(addresses[i], account);
+			if (i % 1000 == 999) {
+				tree.getRoot();
+			}
+		}
+		tree.getRoot();
+		double build = secondsSince(start) / addresses.size() * 1e6;
+		storage.checkpoint();
+		buildSize = directorySize(directory);
+
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < updateCount; i++) {
+			Account account;
+			account.balance = rng();
+			tree.set(addresses[rng() % addresses.size()], account);
+			if (i % 1000 == 999) {
+				tree.getRoot();
+			}
+		}
+		root = tree.getRoot();
+		double update = secondsSince(start) / updateCount * 1e6;
+		storage.checkpoint();
+		uint64_t updateSize = (directorySize(directory) - buildSize) / updateCount;
+
+		uint64_t checksum = 0;
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < updateCount; i++) {
+			checksum += tree.get(addresses[rng() % addresses.size()]).balance;
+		}
+		double get = secondsSince(start) / updateCount * 1e6;
+		log(LogLevel::INFO, "Benchmark", "%s: build %.1f us, update %.1f us, %llu bytes written per update, get %.2f us (%d)",
+			name, build, update, (unsigned long long)updateSize, get, (int)(checksum % 2));
+	}
+
+	//a reopened storage with the node cache off, so every get reads its nodes
+	KeyValueStorage storage;
+	storage.init(directory);
+	uint64_t cacheCapacity = Tree::Node::getCache().getStats().capacity;
+	Tree::Node::getCache().setCapacity(0);
+	Tree tree;
+	tree.init(&storage, root);
+	uint64_t checksum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < updateCount; i++) {
+		checksum += tree.get(addresses[rng() % addresses.size()]).balance;
+	}
+	double coldGet = secondsSince(start) / updateCount * 1e6;
+	Tree::Node::getCache().setCapacity(cacheCapacity);
+	log(LogLevel::INFO, "Benchmark", "%s: cold get %.1f us, %.0f MB on disk after the build (%d)", name, coldGet, buildSize / 1e6, (int)(checksum % 2));
+}
+
+//the binary trie against the 16 and 256 way radix tries, with the accounts of a large chain
+void radixBenchmark(const std::string& directory) {
+	std::mt19937_64 rng(9);
+	std::vector<EccPublicKey> addresses = createAddresses(rng, 1000000);
+	measureTrie<MerkleTrie<EccPublicKey, Account, true, 1>>("binary", directory + "/binary", addresses);
+	measureTrie<MerkleTrie<EccPublicKey, Account, true, 4>>("radix 16", directory + "/radix16", addresses);
+	measureTrie<MerkleTrie<EccPublicKey, Account, true, 8>>("radix 256", directory + "/radix256", addresses);
+}
@@ -2,6 +2,35 @@
 // Copyright (c) 2024 Julian Hinxlage. All rights reserved.
 //
 
+#include "Benchmark.h"
+#include "util/log.h"
+#include <map>
+#include <filesystem>
+
 int main(int argc, char* argv[]) {
+	std::map<std::string, void(*)(const std::string&)> benchmarks = {
+		{ "compression", compressionBenchmark },
+		{ "keys", keyBenchmark },
+		{ "hashed-keys", hashedKeyBenchmark },
+		{ "radix", radixBenchmark },
+	};
+
+	if (argc < 2) {
+		for (auto& i : benchmarks) {
+			log(LogLevel::INFO, "Benchmark", "%s", i.first.c_str());
+		}
+		return 0;
+	}
+	auto benchmark = benchmarks.find(argv[1]);
+	if (benchmark == benchmarks.end()) {
+		log(LogLevel::ERROR, "Benchmark", "unknown benchmark %s", argv[1]);
+		return 1;
+	}
+
+	//data is written to a scratch directory that is removed afterwards
+	std::string directory = argc > 2 ? argv[2] : (std::filesystem::temp_directory_path() / "benchmark").string();
+	std::filesystem::remove_all(directory);
+	benchmark->second(directory);
+	std::filesystem::remove_all(directory);
 	return 0;
 }
@@ -120,6 +120,11 @@ int main(int argc, char* argv[]) {
 
 
 	Validator validator;
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--archival") {
+			validator.node.blockChain.config.initArchival();
+		}
+	}
 	validator.init(chainDir, keyFile, search("entry.txt"));
 
 
@@ -138,7 +143,7 @@ int main(int argc, char* argv[]) {
 		}
 		else if (cmd == "info") {
 			EccPublicKey address = validator.keyStore.getPublicKey();
-			Account account = validator.node.blockChain.getAccountTree().get(address);
+			Account account = validator.node.blockChain.getAccount(address);
 
 			terminal.log("block count:  %i\n", validator.node.blockChain.getBlockCount());
 			terminal.log("chain tip:    %s\n", toHex(validator.node.blockChain.getHeadBlock()).c_str());
@@ -157,6 +162,14 @@ int main(int argc, char* argv[]) {
 			}
 			terminal.log("transactions: %u\n", account.transactionCount);
 		}
+		else if (cmd == "stats") {
+			for (auto& stats : validator.node.blockChain.getStorageStats()) {
+				uint64_t lookups = stats.cache.hits + stats.cache.misses;
+				double hitRate = lookups == 0 ? 0 : (double)stats.cache.hits / lookups * 100.0;
+				terminal.log("%-17s cache %llu/%llu KB, %llu entries, hits %llu, misses %llu (%.1f%% hit rate), evictions %llu\n", (stats.name + ":").c_str(),
+					stats.cache.bytes / 1024, stats.cache.capacity / 1024, stats.cache.entries, stats.cache.hits, stats.cache.misses, hitRate, stats.cache.evictions);
+			}
+		}
 		else {
 			terminal.log("invalid command\n");
 		}